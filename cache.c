@@ -0,0 +1,293 @@
+#ifndef TARZAN_CACHE
+
+/*
+
+Cache of compiled files, which lets a file that runs again skip the interpreter and the compiler. It has the following functions:
+- cache_load: maps the program of a file from its cache, returns false if there is no cache for the file as it is now or the program in it isn't valid
+- cache_store: writes a compiled program to the cache of its file
+- cache_close: unmaps the cached program
+
+A file that is compiled with --compile gets its program written next to it, with .tzn replaced by .tzc, or .tzc added to other names. When the file runs again, without --interpret, and the cache still belongs to it, the program is mapped from the cache and runs in the register machine right away: the file isn't parsed, its constants aren't loaded and none of the tables of the interpreter are set up. Only the text of the file is read, to check the cache.
+
+The cache starts with a header that holds the 64 bit FNV-1a hash and the size of the text of the file the program was compiled from. A cache whose hash or size doesn't match the file is left alone and the file runs as if there was none, and a --compile run writes a new one. The header also holds CACHE_VERSION and the sizes of the structures and settings the program depends on, so a cache written by another build of Tarzan isn't used either. CACHE_VERSION goes up whenever the instructions change.
+
+After the header come the instructions, the values of the registers, the series and their terms, each starting at a multiple of 8 bytes. The program points straight into the mapped file. Since the machine doesn't check the registers and targets of the instructions it runs, a cache is only used once a single pass over the program found every opcode, register, jump target, series and term in range, the last instruction one that doesn't run on past the end and no op_return that can run before a call. A cache that was damaged or edited is then left alone like one that doesn't match. The pages are private, so the handler addresses the machine writes into the instructions before it runs them stay in this process. A cache is written to a file of its own first and then renamed, so runs that start at the same time never see half of one.
+
+Building with -DTARZAN_NO_CACHE turns the cache off, and so do systems without mmap.
+
+*/
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(TARZAN_NO_CACHE)
+#define CACHE_MMAP
+#include <fcntl.h> // open, O_RDONLY
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close, getpid
+#endif
+
+// Version of the cache, which goes up when the instructions or the structures in the cache change
+const u32 CACHE_VERSION = 1;
+
+typedef struct {
+  char magic[4]; // "TZC" and a 0
+  u32 version;
+  u64 hash; // FNV-1a hash of the text of the file
+  i64 source_size;
+  // Sizes of the structures and settings of the build that wrote the cache
+  u32 instruction_size;
+  u32 number_size;
+  u32 series_size;
+  u32 term_size;
+  u32 opcode_count;
+  i32 unroll_factor;
+  // Sizes of the program
+  i32 length;
+  i32 register_count;
+  i32 series_count;
+  i32 series_term_count;
+} CacheHeader;
+
+u8 *cache_map = 0; // Mapped cache of the running program, 0 if it was compiled in this run
+i64 cache_map_size = 0;
+
+// Returns the 64 bit FNV-1a hash of the text of the file
+u64 cache_hash() {
+  u64 hash = 0xCBF29CE484222325ULL;
+  for (i64 i = 0; i < file_size; i++) {
+    hash = (hash ^ file_data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+// Returns the header that a cache of the file as it is now has for a program of the given sizes
+CacheHeader cache_header(i32 length, i32 register_count, i32 series_count, i32 series_term_count) {
+  CacheHeader header = {
+    .magic = {'T', 'Z', 'C', 0},
+    .version = CACHE_VERSION,
+    .hash = cache_hash(),
+    .source_size = file_size,
+    .instruction_size = sizeof(Instruction),
+    .number_size = sizeof(Number),
+    .series_size = sizeof(Series),
+    .term_size = sizeof(SeriesTerm),
+    .opcode_count = op_series + 1,
+    .unroll_factor = UNROLL_FACTOR,
+    .length = length,
+    .register_count = register_count,
+    .series_count = series_count,
+    .series_term_count = series_term_count
+  };
+  return header;
+}
+
+// Returns the size of a part of the cache, which is padded to a multiple of 8 bytes
+i64 cache_part_size(i64 size) {
+  return (size + 7) & ~(i64)7;
+}
+
+// Returns the size of the cache of a program with the given header
+i64 cache_size(CacheHeader *header) {
+  return cache_part_size(sizeof(CacheHeader)) + cache_part_size((i64)header->length * sizeof(Instruction)) +
+    cache_part_size((i64)header->register_count * sizeof(Number)) + cache_part_size((i64)header->series_count * sizeof(Series)) +
+    cache_part_size((i64)header->series_term_count * sizeof(SeriesTerm));
+}
+
+// Returns the name of the cache of a file in the arena
+char *cache_name(char *file_name) {
+  i32 length = strlen(file_name);
+  char *name = (char *)arena_fill(arena, length + 5);
+  strcpy(name, file_name);
+  if (length >= 4 && strcmp(file_name + length - 4, ".tzn") == 0) {
+    strcpy(name + length - 4, ".tzc");
+  } else {
+    strcpy(name + length, ".tzc");
+  }
+  return name;
+}
+
+// Returns true if a register is one of the registers of the program
+bool cache_register_valid(Program *program, i32 index) {
+  return index >= 0 && index < program->register_count;
+}
+
+// Returns true if no op_return can run before an op_call, which would return with an empty call stack
+// The instructions that run in the frame of the program are followed from the first one, and a call continues after itself since its snippet returns there
+bool cache_returns_valid(Program *program) {
+  u8 *seen = calloc(program->length, 1);
+  i32 *pending = malloc(program->length * sizeof(i32));
+  bool valid = seen != 0 && pending != 0;
+  i32 pending_count = 0;
+  if (valid) {
+    pending[pending_count++] = 0;
+    seen[0] = 1;
+  }
+  while (valid && pending_count > 0) {
+    Instruction *instruction = &program->code[pending[--pending_count]];
+    i32 index = (i32)(instruction - program->code);
+    u8 code = instruction->code;
+    if (code == op_return) {
+      valid = false;
+      break;
+    }
+    // Every instruction but these can continue at the next one, which the last instruction of the program can't be
+    i32 next[2] = {index + 1, -1};
+    if (code == op_halt) {
+      next[0] = -1;
+    } else if (code == op_jump) {
+      next[0] = instruction->a;
+    } else if (code >= op_jump_if_equal && code <= op_jump_if_greater_equal) {
+      next[1] = instruction->a;
+    }
+    for (i32 i = 0; i < 2; i++) {
+      if (next[i] >= 0 && !seen[next[i]]) {
+        seen[next[i]] = 1;
+        pending[pending_count++] = next[i];
+      }
+    }
+  }
+  free(seen);
+  free(pending);
+  return valid;
+}
+
+// Returns true if the instructions, series and terms of a program mapped from a cache only refer to registers, instructions, series and terms it has
+bool cache_program_valid(Program *program) {
+  for (i32 i = 0; i < program->length; i++) {
+    Instruction *instruction = &program->code[i];
+    u8 code = instruction->code;
+    bool valid = false;
+    if (code == op_halt || code == op_return) {
+      valid = true;
+    } else if (code == op_move || code == op_increment || code == op_negate) {
+      valid = cache_register_valid(program, instruction->a) && cache_register_valid(program, instruction->b);
+    } else if (code >= op_add && code <= op_divide) {
+      valid = cache_register_valid(program, instruction->a) && cache_register_valid(program, instruction->b) &&
+        cache_register_valid(program, instruction->c);
+    } else if (code >= op_jump_if_equal && code <= op_jump_if_greater_equal) {
+      valid = instruction->a >= 0 && instruction->a < program->length && cache_register_valid(program, instruction->b) &&
+        cache_register_valid(program, instruction->c);
+    } else if (code == op_jump || code == op_call) {
+      valid = instruction->a >= 0 && instruction->a < program->length;
+    } else if (code == op_print) {
+      valid = cache_register_valid(program, instruction->b);
+    } else if (code == op_precision) {
+      valid = instruction->b >= 0 && instruction->b <= MAX_DIVISION_PRECISION;
+    } else if (code == op_rounding) {
+      valid = instruction->b >= 0 && instruction->b <= 255;
+    } else if (code == op_series) {
+      valid = instruction->a >= 0 && instruction->a < program->series_count;
+    }
+    if (!valid) return false;
+  }
+  // The machine runs on to the next instruction after all others, so the program has to end with one that doesn't
+  u8 last = program->code[program->length - 1].code;
+  if (last != op_halt && last != op_return && last != op_jump) return false;
+  for (i32 i = 0; i < program->series_count; i++) {
+    Series *series = &program->series[i];
+    if (!cache_register_valid(program, series->counter) || !cache_register_valid(program, series->step) ||
+        !cache_register_valid(program, series->bound) || series->first_term < 0 || series->term_count < 0 ||
+        (i64)series->first_term + series->term_count > program->series_term_count) {
+      return false;
+    }
+  }
+  for (i32 i = 0; i < program->series_term_count; i++) {
+    SeriesTerm *term = &program->series_terms[i];
+    if (!cache_register_valid(program, term->target) || !cache_register_valid(program, term->source)) return false;
+  }
+  return cache_returns_valid(program);
+}
+
+// cache_load: maps the program of a file from its cache, returns false if there is no cache for the file as it is now
+bool cache_load(Program *program, char *file_name) {
+#ifdef CACHE_MMAP
+  i32 descriptor = open(cache_name(file_name), O_RDONLY);
+  if (descriptor < 0) return false;
+  struct stat status;
+  if (fstat(descriptor, &status) != 0 || status.st_size < (i64)sizeof(CacheHeader)) {
+    close(descriptor);
+    return false;
+  }
+  u8 *map = mmap(0, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (map == MAP_FAILED) return false;
+
+  // The header has to be the one the file would get now, apart from the sizes of the program
+  CacheHeader *header = (CacheHeader *)map;
+  CacheHeader expected = cache_header(header->length, header->register_count, header->series_count, header->series_term_count);
+  if (memcmp(header, &expected, sizeof(CacheHeader)) != 0 || header->length <= 0 || header->register_count < 0 ||
+      header->series_count < 0 || header->series_term_count < 0 || cache_size(header) != status.st_size) {
+    munmap(map, status.st_size);
+    return false;
+  }
+  // The program is only handed out once it's valid, so a cache that isn't leaves it as it was
+  Program loaded = *program;
+  u8 *part = map + cache_part_size(sizeof(CacheHeader));
+  loaded.length = header->length;
+  loaded.code = (Instruction *)part;
+  part += cache_part_size((i64)header->length * sizeof(Instruction));
+  loaded.register_count = header->register_count;
+  loaded.values = (Number *)part;
+  part += cache_part_size((i64)header->register_count * sizeof(Number));
+  loaded.series_count = header->series_count;
+  loaded.series = (Series *)part;
+  part += cache_part_size((i64)header->series_count * sizeof(Series));
+  loaded.series_term_count = header->series_term_count;
+  loaded.series_terms = (SeriesTerm *)part;
+  if (!cache_program_valid(&loaded)) {
+    munmap(map, status.st_size);
+    return false;
+  }
+  *program = loaded;
+  cache_map = map;
+  cache_map_size = status.st_size;
+  return true;
+#else
+  (void)program;
+  (void)file_name;
+  return false;
+#endif
+}
+
+// Writes a part of the cache padded to a multiple of 8 bytes, returns false if it couldn't be written
+bool cache_write(FILE *file, void *data, i64 size) {
+  u8 padding[8] = {0};
+  i64 padding_size = cache_part_size(size) - size;
+  return (i64)fwrite(data, 1, size, file) == size && (i64)fwrite(padding, 1, padding_size, file) == padding_size;
+}
+
+// cache_store: writes a compiled program to the cache of its file
+void cache_store(Program *program, char *file_name) {
+#ifdef CACHE_MMAP
+  // A file that can't be written, like one in a directory that is read-only, just isn't cached
+  char *name = cache_name(file_name);
+  char *temporary_name = (char *)arena_fill(arena, strlen(name) + 24);
+  sprintf(temporary_name, "%s.%ld", name, (long)getpid());
+  FILE *file = fopen(temporary_name, "wb");
+  if (file == NULL) return;
+  CacheHeader header = cache_header(program->length, program->register_count, program->series_count, program->series_term_count);
+  bool written = cache_write(file, &header, sizeof(CacheHeader)) &&
+    cache_write(file, program->code, (i64)program->length * sizeof(Instruction)) &&
+    cache_write(file, program->values, (i64)program->register_count * sizeof(Number)) &&
+    cache_write(file, program->series, (i64)program->series_count * sizeof(Series)) &&
+    cache_write(file, program->series_terms, (i64)program->series_term_count * sizeof(SeriesTerm));
+  if (fclose(file) != 0 || !written || rename(temporary_name, name) != 0) {
+    remove(temporary_name);
+  }
+#else
+  (void)program;
+  (void)file_name;
+#endif
+}
+
+// cache_close: unmaps the cached program
+void cache_close() {
+#ifdef CACHE_MMAP
+  if (cache_map != 0) {
+    munmap(cache_map, cache_map_size);
+    cache_map = 0;
+  }
+#endif
+}
+
+#define TARZAN_CACHE
+#endif
@@ -0,0 +1,796 @@
+#ifndef TARZAN_COMPILER
+
+/*
+
+Compiler that translates a Tarzan file into a program for the register machine in vm.c. It has the following functions:
+- compile_program: parses the whole file and generates a program, returns false if the file has to be interpreted instead
+- compile_region: generates a program for the while or use statement at a read position of the running interpreter, returns false if the statement has to be interpreted
+
+Compiling is done in three steps. The parser reads the file into a tree of statements and expressions, following the interpreter character by character so that a compiled program behaves exactly like an interpreted one. The optimizer in optimizer.c then simplifies the tree, and ir.c translates it into static single assignment form, optimizes that further and generates the instructions.
+
+Every declared variable gets a register of its own, which is handed back when the block of the variable ends. Snippets use the variables of the scope they are used in, so a snippet body is parsed once for every distinct scope it is used in and becomes an instance that is called like a function. Calls to the same snippet from the same scope share one instance, which also covers snippets that use themselves without declaring variables first.
+
+Files that only fail at runtime in the interpreter, like ones that refer to variables or snippets that don't exist, or that contain tokens the interpreter would skip with a message, are not compiled. They are left to the interpreter, which reports the problem at the right point of the output.
+
+A region is a single statement that the interpreter is about to run, compiled with the variables and snippets the interpreter has at that point. The variables of the interpreter are bound in the order they were declared and get the registers after the constants, so the interpreter can set their registers before the program runs and read them back after it halts. Their values aren't known when compiling, since the region runs again whenever the interpreter reaches the statement.
+
+*/
+
+typedef struct {
+  u8 constant;
+  u8 variable;
+  u8 operation;
+  u8 negation;
+} ExpressionKinds;
+
+const ExpressionKinds expression_kinds = {
+  .constant = 1,
+  .variable = 2,
+  .operation = 3,
+  .negation = 4 // minus in front of an operand, which is the left expression
+};
+
+typedef struct {
+  u8 assign;
+  u8 print;
+  u8 loop;
+  u8 branch;
+  u8 block;
+  u8 call;
+  u8 precision;
+  u8 rounding;
+} StatementKinds;
+
+const StatementKinds statement_kinds = {
+  .assign = 1,
+  .print = 2,
+  .loop = 3, // while
+  .branch = 4, // if with an optional else chain
+  .block = 5, // else block
+  .call = 6, // use
+  .precision = 7,
+  .rounding = 8
+};
+
+typedef struct Binding Binding;
+typedef struct Expression Expression;
+struct Expression {
+  u8 kind;
+  u8 op_code; // Operator of an operation
+  i32 reg; // Register of a constant or a variable, negative for registers added by the optimizer
+  Number value; // Value of a constant
+  Binding *binding; // Binding of a variable, 0 for registers added by the optimizer
+  Expression *left;
+  Expression *right;
+};
+
+typedef struct Instance Instance;
+typedef struct Statement Statement;
+struct Statement {
+  u8 kind;
+  u8 comparator; // Comparator of a while or if condition
+  i32 reg; // Assigned register, negative for registers added by the optimizer, or the precision or rounding setting
+  Binding *binding; // Assigned variable, 0 for registers added by the optimizer
+  Expression *value; // Assigned or printed value, or the left side of a condition
+  Expression *right; // Right side of a condition
+  Statement *body; // Body of a while, if or else block
+  Statement *otherwise; // Else branch of an if
+  Instance *instance; // Snippet instance called by use
+  Statement *next;
+};
+
+// Variable name bound to a register, linked to the bindings declared before it
+struct Binding {
+  u8 *name;
+  i32 length;
+  i32 reg;
+  i32 assignments; // Number of statements that assign the variable, including its declaration
+  Expression *value; // Value the variable is declared with
+  i32 loop_mark; // Last loop found to assign the variable
+  Binding *previous;
+};
+
+// Snippet declared at the top level of the file
+typedef struct {
+  u8 *name;
+  i32 length;
+  i64 index; // Read position of the snippet body
+} Definition;
+
+// Snippet body parsed for one scope
+struct Instance {
+  i32 id;
+  i32 definition; // Index in the definitions array
+  i32 visible_definitions; // Number of definitions that existed when the instance was used
+  Binding *scope; // Scope the snippet is used in
+  Statement *body;
+  i32 entry; // First instruction of the instance, -1 until it's generated
+  bool called; // Set when a call to the instance is generated
+  bool inlining; // Set while the body is generated in place of a call
+  i32 loop_mark; // Last loop whose assignments were collected through this instance
+};
+
+// Most snippet instances a file can have before it's left to the interpreter
+const i32 MAX_INSTANCES = 1024;
+
+// Snippet bodies with at most this many statements are generated in place of their calls, up to this many snippets deep
+const i32 MAX_INLINE_STATEMENTS = 8;
+const i32 MAX_INLINE_DEPTH = 4;
+
+// Small counted loops test their condition once every this many iterations, building with -DTARZAN_UNROLL=1 turns that off
+#ifndef TARZAN_UNROLL
+#define TARZAN_UNROLL 4
+#endif
+const i32 UNROLL_FACTOR = TARZAN_UNROLL;
+// Most instructions a loop can have to be unrolled
+const i32 MAX_UNROLL_VALUES = 16;
+
+// Parser state
+i64 parse_position = 0; // Read position of the parser
+bool parse_failed = false; // Set when the file can't be compiled
+Binding *scope = 0; // Innermost variable binding
+i32 register_top = 0; // First register that isn't bound to a variable
+i32 register_count = 0; // Number of registers the program needs
+i32 block_depth = 0; // Number of blocks and snippet bodies the parser is in
+Array *definitions = 0; // Snippets declared at the top level
+i32 visible_definitions = 0; // Number of definitions that exist when the current top level statement runs
+Array *instances = 0; // Pointers to all snippet instances
+bool division_settings_used = false; // Set when the file changes the precision or rounding of divisions
+Binding *region_scope = 0; // Variables of the interpreter that a compiled region writes to their registers when it halts, 0 when compiling the whole file
+
+// Generator state
+Array *instructions = 0; // Generated instructions
+Array *series = 0; // Loops that op_series computes without running them
+Array *series_terms = 0; // Terms of those loops
+
+// Marks the file as not compilable
+void compile_fail() {
+  parse_failed = true;
+}
+
+bool at_token(const char *token) {
+  i32 token_length = strlen(token);
+  if (parse_position + token_length > file_size) return false;
+  return memcmp(file_data + parse_position, token, token_length) == 0;
+}
+
+// Returns true if a keyword is at the parse position and followed by a space or a digit, like is_keyword
+bool at_keyword(const char *keyword) {
+  i32 keyword_length = strlen(keyword);
+  if (!at_token(keyword) || parse_position + keyword_length >= file_size) return false;
+  u8 next = file_data[parse_position + keyword_length];
+  return next == ' ' || (next >= '0' && next <= '9');
+}
+
+void parser_skip_spaces() {
+  while (at_token(" ")) {
+    parse_position += 1;
+  }
+}
+
+// Skip past the next newline, like skip_line
+void parser_skip_line() {
+  while (!at_token("\n") && parse_position < file_size) {
+    parse_position += 1;
+  }
+  parse_position += 1;
+}
+
+// Skip past the next {, like enter_block
+void parser_enter_block() {
+  while (!at_token("{") && parse_position < file_size) {
+    parse_position += 1;
+  }
+  parse_position += 1;
+}
+
+// Returns the read position after the } that closes the block starting at position, counting braces like skip_block
+i64 find_block_end(i64 position) {
+  i32 block_count = 1;
+  while (block_count > 0 && position < file_size) {
+    if (file_data[position] == '{') {
+      block_count += 1;
+    } else if (file_data[position] == '}') {
+      block_count -= 1;
+    }
+    position += 1;
+  }
+  return position;
+}
+
+// Parses out a name like parse_name, without copying it
+void parser_name(u8 **name, i32 *length) {
+  parser_skip_spaces();
+  *name = &file_data[parse_position];
+  *length = 0;
+  while (parse_position < file_size && ((file_data[parse_position] >= 'a' && file_data[parse_position] <= 'z') || file_data[parse_position] == '_')) {
+    *length += 1;
+    parse_position += 1;
+  }
+}
+
+// Finds the innermost binding of a variable name
+Binding *find_binding(u8 *name, i32 length) {
+  Binding *binding = scope;
+  while (binding != 0) {
+    if (binding->length == length && memcmp(binding->name, name, length) == 0) {
+      return binding;
+    }
+    binding = binding->previous;
+  }
+  return 0;
+}
+
+// Binds a variable name to the next free register
+void bind_variable(u8 *name, i32 length) {
+  Binding *binding = (Binding *)arena_fill(arena, sizeof(Binding));
+  binding->name = name;
+  binding->length = length;
+  binding->reg = register_top;
+  binding->assignments = 0;
+  binding->value = 0;
+  binding->loop_mark = 0;
+  binding->previous = scope;
+  scope = binding;
+  register_top += 1;
+  if (register_top > register_count) {
+    register_count = register_top;
+  }
+}
+
+Expression *new_expression(u8 kind, u8 op_code, i32 reg, Expression *left, Expression *right) {
+  Expression *expression = (Expression *)arena_fill(arena, sizeof(Expression));
+  memset(expression, 0, sizeof(Expression));
+  expression->kind = kind;
+  expression->op_code = op_code;
+  expression->reg = reg;
+  expression->left = left;
+  expression->right = right;
+  return expression;
+}
+
+Statement *new_statement(u8 kind) {
+  Statement *statement = (Statement *)arena_fill(arena, sizeof(Statement));
+  memset(statement, 0, sizeof(Statement));
+  statement->kind = kind;
+  return statement;
+}
+
+#include "optimizer.c"
+
+bool parser_at_expression_end() {
+  return at_token(")") || at_token(";") || at_token("<") || at_token(">") || at_token("=") || parse_position >= file_size;
+}
+
+// Returns the operator at the parse position, or 0 if there is none
+u8 parser_operator() {
+  if (at_token("+")) {
+    return operators.plus;
+  } else if (at_token("-")) {
+    return operators.minus;
+  } else if (at_token("*")) {
+    return operators.multiply;
+  } else if (at_token("/")) {
+    return operators.divide;
+  }
+  return 0;
+}
+
+Expression *parse_operation(u8 min_precedence);
+
+// Parses an operand like compile_operand, failing where the interpreter would stop with an error
+Expression *parse_operand() {
+  parser_skip_spaces();
+  if (at_token("-")) {
+    parse_position += 1;
+    Expression *operand = parse_operand();
+    if (operand == 0) return 0;
+    // A negative number is a constant of its own
+    if (operand->kind == expression_kinds.constant) {
+      return fold_constant((Number){.value = (i64)(0 - (u64)operand->value.value), .exponent = operand->value.exponent});
+    }
+    return new_expression(expression_kinds.negation, 0, 0, operand, 0);
+  } else if (at_token("+")) {
+    parse_position += 1;
+    return parse_operand();
+  } else if (parse_position < file_size && file_data[parse_position] >= '0' && file_data[parse_position] <= '9') {
+    i32 constant_index = literal_site(parse_position);
+    if (constant_index == INVALID_ARRAY_INDEX) {
+      compile_fail();
+      return 0;
+    }
+    Expression *operand = new_expression(expression_kinds.constant, 0, constant_index, 0, 0);
+    operand->value = constant_pool[constant_index].value;
+    parse_position += constant_pool[constant_index].length;
+    return operand;
+  } else if (parse_position < file_size && file_data[parse_position] >= 'a' && file_data[parse_position] <= 'z') {
+    u8 *name = 0;
+    i32 length = 0;
+    parser_name(&name, &length);
+    Binding *binding = find_binding(name, length);
+    if (binding == 0) {
+      compile_fail();
+      return 0;
+    }
+    Expression *operand = new_expression(expression_kinds.variable, 0, binding->reg, 0, 0);
+    operand->binding = binding;
+    return operand;
+  } else if (at_token("(")) {
+    parse_position += 1;
+    Expression *operand = parse_operation(1);
+    parser_skip_spaces();
+    if (!at_token(")")) {
+      compile_fail();
+      return 0;
+    }
+    parse_position += 1;
+    return operand;
+  }
+  compile_fail();
+  return 0;
+}
+
+// Parses an operand followed by all operators of at least min_precedence, like compile_operation
+Expression *parse_operation(u8 min_precedence) {
+  Expression *left = parse_operand();
+  while (!parse_failed) {
+    parser_skip_spaces();
+    u8 op_code = parser_operator();
+    if (op_code == 0 || operator_precedence(op_code) < min_precedence) {
+      break;
+    }
+    parse_position += 1;
+    Expression *right = parse_operation(operator_precedence(op_code) + 1);
+    left = new_expression(expression_kinds.operation, op_code, 0, left, right);
+  }
+  return parse_failed ? 0 : left;
+}
+
+// Parses an expression into a tree, grouping operators exactly like the plans of the interpreter
+Expression *parse_expression() {
+  parser_skip_spaces();
+  if (parser_at_expression_end()) {
+    // An empty expression
+    compile_fail();
+    return 0;
+  }
+  Expression *expression = parse_operation(1);
+  parser_skip_spaces();
+  if (!parser_at_expression_end()) {
+    compile_fail();
+  }
+  return parse_failed ? 0 : expression;
+}
+
+// Parses a condition into the comparator and the two sides of a statement, like evaluate_condition
+void parse_condition(Statement *statement) {
+  statement->value = parse_expression();
+  parser_skip_spaces();
+  if (at_token("==")) {
+    statement->comparator = comparators.equal_to;
+    parse_position += 2;
+  } else if (at_token("<=")) {
+    statement->comparator = comparators.less_than_or_equal_to;
+    parse_position += 2;
+  } else if (at_token("<")) {
+    statement->comparator = comparators.less_than;
+    parse_position += 1;
+  } else if (at_token(">=")) {
+    statement->comparator = comparators.greater_than_or_equal_to;
+    parse_position += 2;
+  } else if (at_token(">")) {
+    statement->comparator = comparators.greater_than;
+    parse_position += 1;
+  } else {
+    compile_fail();
+  }
+  parser_skip_spaces();
+  statement->right = parse_expression();
+}
+
+Statement *parse_statements(bool in_block);
+
+// Parses a block body after its {
+// Variables declared in the block are unbound and their registers handed back when it ends
+Statement *parse_block() {
+  i64 block_end = find_block_end(parse_position);
+  Binding *outer_scope = scope;
+  i32 outer_register_top = register_top;
+  block_depth += 1;
+  Statement *body = parse_statements(true);
+  block_depth -= 1;
+  scope = outer_scope;
+  register_top = outer_register_top;
+  // A brace inside a comment makes skipping a block end somewhere else than running it
+  if (parse_position != block_end) {
+    compile_fail();
+  }
+  return body;
+}
+
+// Skips else blocks that follow on the same line, like skip_elses
+void parser_skip_elses() {
+  parser_skip_spaces();
+  while (at_token("else") && parse_position < file_size) {
+    parse_position += 4;
+    parser_enter_block();
+    parse_position = find_block_end(parse_position);
+    parser_skip_spaces();
+  }
+}
+
+Statement *parse_branch();
+
+// Parses the else that follows an if block on the same line, if any
+Statement *parse_else() {
+  i64 position = parse_position;
+  parser_skip_spaces();
+  if (at_token("else if")) {
+    parse_position += 7;
+    return parse_branch();
+  } else if (at_token("else")) {
+    parse_position += 4;
+    Statement *statement = new_statement(statement_kinds.block);
+    parser_enter_block();
+    statement->body = parse_block();
+    parser_skip_elses();
+    return statement;
+  }
+  parse_position = position;
+  return 0;
+}
+
+// Parses an if after the if keyword
+Statement *parse_branch() {
+  Statement *statement = new_statement(statement_kinds.branch);
+  parser_skip_spaces();
+  parse_position += 1; // skip start parenthesis
+  parse_condition(statement);
+  parser_enter_block();
+  statement->body = parse_block();
+  statement->otherwise = parse_else();
+  return statement;
+}
+
+// Returns the instance of a snippet for the current scope, parsing the snippet body if there is none yet
+Instance *use_snippet(u8 *name, i32 length) {
+  i32 definition_index = visible_definitions - 1;
+  while (definition_index >= 0) {
+    Definition *definition = (Definition *)array_get(definitions, definition_index);
+    if (definition->length == length && memcmp(definition->name, name, length) == 0) {
+      break;
+    }
+    definition_index -= 1;
+  }
+  if (definition_index < 0) {
+    compile_fail();
+    return 0;
+  }
+  for (i32 i = 0; i < array_length(instances); i++) {
+    Instance *instance = *(Instance **)array_get(instances, i);
+    if (instance->definition == definition_index && instance->scope == scope && instance->visible_definitions == visible_definitions) {
+      return instance;
+    }
+  }
+  if (array_length(instances) >= MAX_INSTANCES) {
+    compile_fail();
+    return 0;
+  }
+  Instance *instance = (Instance *)arena_fill(arena, sizeof(Instance));
+  instance->id = array_length(instances);
+  instance->definition = definition_index;
+  instance->visible_definitions = visible_definitions;
+  instance->scope = scope;
+  instance->body = 0;
+  instance->entry = -1;
+  instance->called = false;
+  instance->inlining = false;
+  instance->loop_mark = 0;
+  array_push(instances, &instance);
+
+  // Parse the body like a block at the position of the snippet
+  Definition *definition = (Definition *)array_get(definitions, definition_index);
+  i64 return_position = parse_position;
+  parse_position = definition->index;
+  instance->body = parse_block();
+  parse_position = return_position;
+  return instance;
+}
+
+// Parses one statement, like parse_token
+// Returns 0 for statements that don't run anything, like comments and snippet declarations
+Statement *parse_statement() {
+  Statement *statement = 0;
+  if (at_token("while")) {
+    statement = new_statement(statement_kinds.loop);
+    parse_position += 5;
+    parser_skip_spaces();
+    parse_position += 1; // skip start parenthesis
+    parse_condition(statement);
+    parser_enter_block();
+    statement->body = parse_block();
+  } else if (at_token("if")) {
+    parse_position += 2;
+    statement = parse_branch();
+  } else if (at_token("else if")) {
+    // An else if that doesn't follow an if block on the same line runs like an if
+    parse_position += 7;
+    statement = parse_branch();
+  } else if (at_token("else")) {
+    // An else that doesn't follow an if block on the same line always runs
+    parse_position += 4;
+    statement = new_statement(statement_kinds.block);
+    parser_enter_block();
+    statement->body = parse_block();
+    parser_skip_elses();
+  } else if (at_token("num")) {
+    parse_position += 3;
+    u8 *name = 0;
+    i32 length = 0;
+    parser_name(&name, &length);
+    while (at_token(" ") || at_token("=")) {
+      parse_position += 1;
+    }
+    statement = new_statement(statement_kinds.assign);
+    statement->value = parse_expression();
+    parse_position += 1; // Skip the trailing ;
+    bind_variable(name, length);
+    scope->assignments = 1;
+    scope->value = statement->value;
+    statement->reg = scope->reg;
+    statement->binding = scope;
+  } else if (at_token("use")) {
+    parse_position += 3;
+    u8 *name = 0;
+    i32 length = 0;
+    parser_name(&name, &length);
+    parser_skip_line();
+    statement = new_statement(statement_kinds.call);
+    statement->instance = use_snippet(name, length);
+  } else if (at_token("def")) {
+    parse_position += 3;
+    // Snippets declared inside blocks only exist once the block runs
+    if (block_depth > 0) {
+      compile_fail();
+      return 0;
+    }
+    Definition definition = {.name = 0, .length = 0, .index = 0};
+    parser_name(&definition.name, &definition.length);
+    parser_enter_block();
+    definition.index = parse_position;
+    array_push(definitions, &definition);
+    parse_position = find_block_end(parse_position);
+  } else if (at_token("//")) {
+    parser_skip_line();
+  } else if (at_token("print")) {
+    parse_position += 6;
+    statement = new_statement(statement_kinds.print);
+    statement->value = parse_expression();
+    parser_skip_line();
+  } else if (at_keyword("precision")) {
+    parse_position += 9;
+    parser_skip_spaces();
+    i32 constant_index = literal_site(parse_position);
+    Number precision = constant_index == INVALID_ARRAY_INDEX ? (Number){.value = -1, .exponent = 0} : constant_pool[constant_index].value;
+    if (precision.exponent != 0 || precision.value < 0 || precision.value > MAX_DIVISION_PRECISION) {
+      compile_fail();
+      return 0;
+    }
+    statement = new_statement(statement_kinds.precision);
+    division_settings_used = true;
+    statement->reg = (i32)precision.value;
+    parser_skip_line();
+  } else if (at_keyword("rounding")) {
+    parse_position += 8;
+    u8 *name = 0;
+    i32 length = 0;
+    parser_name(&name, &length);
+    statement = new_statement(statement_kinds.rounding);
+    division_settings_used = true;
+    if (length == 8 && memcmp(name, "truncate", 8) == 0) {
+      statement->reg = rounding_modes.truncate;
+    } else if (length == 7 && memcmp(name, "half_up", 7) == 0) {
+      statement->reg = rounding_modes.half_up;
+    } else if (length == 9 && memcmp(name, "half_even", 9) == 0) {
+      statement->reg = rounding_modes.half_even;
+    } else {
+      compile_fail();
+    }
+    parser_skip_line();
+  } else if (file_data[parse_position] >= 'a' && file_data[parse_position] <= 'z') {
+    u8 *name = 0;
+    i32 length = 0;
+    parser_name(&name, &length);
+    Binding *binding = find_binding(name, length);
+    if (binding == 0) {
+      compile_fail();
+      return 0;
+    }
+    while (at_token(" ") || at_token("=")) {
+      parse_position += 1;
+    }
+    binding->assignments += 1;
+    statement = new_statement(statement_kinds.assign);
+    statement->reg = binding->reg;
+    statement->binding = binding;
+    statement->value = parse_expression();
+    parse_position += 1; // Skip the trailing ;
+  } else {
+    // The interpreter prints unknown tokens
+    compile_fail();
+  }
+  return statement;
+}
+
+// Parses statements until the end of the file, or until the } that ends the current block
+Statement *parse_statements(bool in_block) {
+  Statement *first = 0;
+  Statement *last = 0;
+  while (!parse_failed) {
+    while (at_token(" ") || at_token("\n")) {
+      parse_position += 1;
+    }
+    if (parse_position >= file_size) {
+      // A block that never ends
+      if (in_block) {
+        compile_fail();
+      }
+      break;
+    }
+    if (at_token("}")) {
+      parse_position += 1;
+      if (in_block) break;
+      // A } outside of any block has nothing to end
+      continue;
+    }
+    if (!in_block) {
+      visible_definitions = array_length(definitions);
+    }
+    Statement *statement = parse_statement();
+    if (statement == 0) continue;
+    if (last == 0) {
+      first = statement;
+    } else {
+      last->next = statement;
+    }
+    last = statement;
+  }
+  return first;
+}
+
+i32 emit(u8 code, i32 a, i32 b, i32 c) {
+  Instruction instruction = {.code = code, .a = a, .b = b, .c = c};
+  array_push(instructions, &instruction);
+  return array_last(instructions);
+}
+
+#include "ir.c"
+
+// Optimizes the parsed statements and the snippet instances they use, and generates the program
+bool generate_program(Program *program, Statement *statements) {
+  optimize_statements(statements);
+  for (i32 i = 0; i < array_length(instances); i++) {
+    optimize_statements((*(Instance **)array_get(instances, i))->body);
+  }
+  hoist_invariants(statements);
+  for (i32 i = 0; i < array_length(instances); i++) {
+    hoist_invariants((*(Instance **)array_get(instances, i))->body);
+  }
+
+  // Registers added by the optimizer are placed after the variables, followed by the temporaries
+  added_start = register_count;
+  temporary_start = added_start + array_length(added_registers);
+  temporary_count = 1;
+  instructions = array_create(arena, sizeof(Instruction));
+  series = array_create(arena, sizeof(Series));
+  series_terms = array_create(arena, sizeof(SeriesTerm));
+  inline_depth = 0;
+  generate_function(statements, 0);
+  // Generate the instances that are still called, until generating them doesn't call any new ones
+  bool generated = true;
+  while (generated && !parse_failed) {
+    generated = false;
+    for (i32 i = 0; i < array_length(instances) && !parse_failed; i++) {
+      Instance *instance = *(Instance **)array_get(instances, i);
+      if (instance->called && instance->entry < 0) {
+        generate_function(instance->body, instance);
+        generated = true;
+      }
+    }
+  }
+  if (parse_failed) {
+    return false;
+  }
+
+  // Copy the instructions to one block for the machine and resolve the calls
+  program->length = array_length(instructions);
+  program->code = (Instruction *)arena_fill(arena, program->length * sizeof(Instruction));
+  for (i32 i = 0; i < program->length; i++) {
+    Instruction instruction = *(Instruction *)array_get(instructions, i);
+    if (instruction.code == op_call) {
+      instruction.a = (*(Instance **)array_get(instances, instruction.a))->entry;
+      // A call right before a return is a jump, so the called instance returns straight to the caller's caller
+      if (i + 1 < program->length && ((Instruction *)array_get(instructions, i + 1))->code == op_return) {
+        instruction.code = op_jump;
+      }
+    }
+    program->code[i] = instruction;
+  }
+  program->series_count = array_length(series);
+  program->series = (Series *)arena_fill(arena, program->series_count * sizeof(Series) + sizeof(Series));
+  for (i32 i = 0; i < program->series_count; i++) {
+    program->series[i] = *(Series *)array_get(series, i);
+  }
+  program->series_term_count = array_length(series_terms);
+  program->series_terms = (SeriesTerm *)arena_fill(arena, program->series_term_count * sizeof(SeriesTerm) + sizeof(SeriesTerm));
+  for (i32 i = 0; i < program->series_term_count; i++) {
+    program->series_terms[i] = *(SeriesTerm *)array_get(series_terms, i);
+  }
+  program->register_count = temporary_start + temporary_count;
+  program->values = (Number *)arena_fill(arena, program->register_count * sizeof(Number));
+  for (i32 i = 0; i < program->register_count; i++) {
+    if (i < constant_count) {
+      program->values[i] = constant_pool[i].value;
+    } else if (i >= added_start && i < temporary_start) {
+      program->values[i] = *(Number *)array_get(added_registers, i - added_start);
+    } else {
+      program->values[i] = (Number){.value = 0, .exponent = 0};
+    }
+  }
+  return true;
+}
+
+// Resets the parser for a new program
+void start_parser(i64 position) {
+  parse_position = position;
+  parse_failed = false;
+  scope = 0;
+  // Constants take up the first registers
+  register_top = constant_count;
+  register_count = constant_count;
+  block_depth = 0;
+  definitions = array_create(arena, sizeof(Definition));
+  visible_definitions = 0;
+  instances = array_create(arena, sizeof(Instance *));
+  division_settings_used = false;
+  added_registers = array_create(arena, sizeof(Number));
+  region_scope = 0;
+}
+
+// compile_program: parses the whole file and generates a program, returns false if the file has to be interpreted instead
+bool compile_program(Program *program) {
+  start_parser(0);
+  Statement *statements = parse_statements(false);
+  if (parse_failed) {
+    return false;
+  }
+  return generate_program(program, statements);
+}
+
+// compile_region: generates a program for the while or use statement at a read position of the running interpreter, returns false if the statement has to be interpreted
+// The end is set to the read position after the statement
+bool compile_region(Program *program, i64 position, i64 *end) {
+  start_parser(position);
+  for (i32 i = 0; i < array_length(snippets); i++) {
+    Snippet *snippet = (Snippet *)array_get(snippets, i);
+    Definition definition = {.name = (u8 *)snippet->name, .length = strlen(snippet->name), .index = snippet->index};
+    array_push(definitions, &definition);
+  }
+  visible_definitions = array_length(definitions);
+  for (i32 i = 0; i < array_length(variables); i++) {
+    char *name = ((Variable *)array_get(variables, i))->name;
+    bind_variable((u8 *)name, strlen(name));
+    // Declared by the interpreter, with a value that isn't known here
+    scope->assignments = 1;
+  }
+  region_scope = scope;
+  Statement *statement = parse_statement();
+  *end = parse_position;
+  if (parse_failed || statement == 0) {
+    return false;
+  }
+  return generate_program(program, statement);
+}
+
+#define TARZAN_COMPILER
+#endif
\ No newline at end of file
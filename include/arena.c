@@ -6,8 +6,8 @@
 /*
 
 Simple arena allocator that has the following functions:
-- arena_open: initializes the arena and returns a pointer to it
-- arena_fill: allocates memory in the arena and returns a pointer to it
+- arena_open: initializes the arena and returns a pointer to it, or 0 if the memory couldn't be allocated
+- arena_fill: allocates memory in the arena and returns a pointer to it, or 0 if it couldn't
 - arena_close: frees all memory in the arena and all sub-arenas
 - arena_reset: resets all heads in arena and sub-arenas to 0 without freeing memory
 - arena_size: returns the used size of the arena and all sub-arenas
@@ -32,7 +32,12 @@ typedef struct Arena {
 // arena_open creates a new arena with a size and returns a pointer to it
 Arena *arena_open(i32 size) {
   Arena *arena = (Arena *)malloc(sizeof(Arena));
+  if (arena == 0) return 0;
   arena->data = (u8 *)malloc(size);
+  if (arena->data == 0) {
+    free(arena);
+    return 0;
+  }
   arena->head = 0;
   arena->capacity = size;
   arena->next = 0;
@@ -56,11 +61,12 @@ void *arena_fill(Arena *arena, i32 size) {
   if (aligned_head + size > arena->capacity) {
     if (arena->next == 0) {
       // Cap the arena size at MAX_ARENA_SIZE
-      if (arena->capacity * 2 > MAX_ARENA_SIZE) {
+      if (arena->capacity > MAX_ARENA_SIZE / 2) {
         arena->next = arena_open(MAX_ARENA_SIZE);
       } else {
         arena->next = arena_open(arena->capacity * 2);
       }
+      if (arena->next == 0) return 0;
     }
     return arena_fill(arena->next, size);
   }
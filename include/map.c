@@ -0,0 +1,119 @@
+#ifndef C9_MAP
+
+#include <stdbool.h> // bool
+#include <string.h> // memset, memcpy
+
+#include "types.c" // i32, i64, u8, u64
+#include "arena.c" // Arena, arena_fill
+
+/*
+
+Hash map from non-negative integer keys to items of a fixed size, that has the following functions:
+ - map_create: initializes the map with an item size and the number of items expected and returns a pointer to it
+ - map_get: returns the item of a key, or 0 if the key has none
+ - map_put: returns the item of a key, adding a zeroed item if the key has none, or 0 if the allocation failed
+ - map_length: returns the number of items in the map
+
+The map is made for tables that are indexed by a position, like a read position in a file, where only few positions have an item. It uses open addressing with linear probing in a table that is a power of two large and at most half full. The keys are kept apart from the items, so probing only reads keys.
+
+When the table is half full it's doubled and the items are moved to the new table, so pointers to items are only valid until the next map_put that adds a key. The old table stays in the arena, which costs at most as much memory as the current table.
+
+*/
+
+const i64 MAP_EMPTY_KEY = -1;
+
+typedef struct {
+  Arena *arena;
+  i64 *keys; // Key of each slot, or MAP_EMPTY_KEY
+  u8 *items; // Item of each slot
+  i32 item_size;
+  i32 length; // Number of items in the map
+  i32 capacity; // Number of slots, a power of two
+  i32 shift; // 64 minus the number of bits of a slot index
+} Map;
+
+// Allocate a table with the given number of slots, returns false if it doesn't fit in the arena
+static bool map_allocate(Map *map, i32 capacity) {
+  i64 key_size = (i64)capacity * sizeof(i64);
+  i64 items_size = (i64)capacity * map->item_size;
+  if (key_size > MAX_ARENA_SIZE || items_size > MAX_ARENA_SIZE) return false;
+  i64 *keys = (i64 *)arena_fill(map->arena, (i32)key_size);
+  u8 *items = (u8 *)arena_fill(map->arena, (i32)items_size);
+  if (keys == 0 || items == 0) return false;
+  memset(keys, 0xFF, key_size);
+  memset(items, 0, items_size);
+  map->keys = keys;
+  map->items = items;
+  map->capacity = capacity;
+  map->shift = 64;
+  for (i32 size = capacity; size > 1; size /= 2) {
+    map->shift -= 1;
+  }
+  return true;
+}
+
+// Returns the slot of a key, or the empty slot where it would be added
+static i32 map_slot(Map *map, i64 key) {
+  i32 slot = (i32)(((u64)key * 0x9E3779B97F4A7C15u) >> map->shift);
+  while (map->keys[slot] != key && map->keys[slot] != MAP_EMPTY_KEY) {
+    slot = (slot + 1) & (map->capacity - 1);
+  }
+  return slot;
+}
+
+// Create a new map with a given item size and room for a number of items before it grows, returns 0 if the allocation failed
+Map *map_create(Arena *arena, i32 item_size, i32 expected) {
+  Map *map = (Map *)arena_fill(arena, sizeof(Map));
+  if (map == 0) return 0;
+  map->arena = arena;
+  map->item_size = item_size;
+  map->length = 0;
+  i32 capacity = 16;
+  while (capacity < MAX_ARENA_SIZE / 2 && capacity / 2 < expected) {
+    capacity *= 2;
+  }
+  if (!map_allocate(map, capacity)) return 0;
+  return map;
+}
+
+// Get the item of a key, or 0 if the key has none
+void *map_get(Map *map, i64 key) {
+  i32 slot = map_slot(map, key);
+  if (map->keys[slot] == MAP_EMPTY_KEY) return 0;
+  return map->items + (i64)slot * map->item_size;
+}
+
+// Get the item of a key, adding a zeroed item for it if it has none
+// Returns 0 if the table had to grow and the allocation failed
+void *map_put(Map *map, i64 key) {
+  i32 slot = map_slot(map, key);
+  if (map->keys[slot] != MAP_EMPTY_KEY) {
+    return map->items + (i64)slot * map->item_size;
+  }
+  // Double the table before it gets more than half full, and move the items over
+  if ((map->length + 1) * 2 > map->capacity) {
+    Map old = *map;
+    if (!map_allocate(map, old.capacity * 2)) {
+      *map = old;
+      return 0;
+    }
+    for (i32 i = 0; i < old.capacity; i++) {
+      if (old.keys[i] == MAP_EMPTY_KEY) continue;
+      i32 new_slot = map_slot(map, old.keys[i]);
+      map->keys[new_slot] = old.keys[i];
+      memcpy(map->items + (i64)new_slot * map->item_size, old.items + (i64)i * map->item_size, map->item_size);
+    }
+    slot = map_slot(map, key);
+  }
+  map->keys[slot] = key;
+  map->length += 1;
+  return map->items + (i64)slot * map->item_size;
+}
+
+// Return the number of items in the map
+i32 map_length(Map *map) {
+  return map->length;
+}
+
+#define C9_MAP
+#endif
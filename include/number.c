@@ -0,0 +1,402 @@
+#ifndef C9_NUMBER
+
+#include <stdbool.h> // bool
+#include <string.h> // memcpy
+
+#include "types.c" // i16, i32, i64, u8, u32, u64
+
+/*
+
+Decimal number type that has the following functions:
+- number_parse: reads a number from decimal text and returns the number of characters read
+- number_format: writes a number as decimal text into a buffer and returns the text length
+- number_compact: removes trailing decimal zeros from a number
+- number_align: rewrites two numbers to the lowest of their exponents
+- number_add, number_subtract, number_multiply: exact decimal arithmetic
+- number_compare: returns -1, 0 or 1 when a number is less than, equal to or greater than another
+- number_divide: divides two numbers to a given number of decimals using a rounding mode
+- reciprocal_create: precomputes the multiply-shift reciprocal of a divisor
+- reciprocal_divide: divides by multiplying with a precomputed reciprocal
+
+A number is stored as an integer value and a base 10 exponent, which means that 1.25 is stored as 125 * 10^-2. This keeps decimal numbers exact as long as the value fits in 64 bits.
+
+Division keeps a given number of decimals more than its most precise operand, so with 3 decimals 100 / 3 is 33.333 and 0.5 / 3 is 0.1666. Hardware division is slow, so the quotient is instead calculated by multiplying with a precomputed reciprocal of the divisor and shifting. Reciprocals are kept in a small cache keyed by the divisor, which means that dividing by a literal or by a value that doesn't change in a loop only computes the reciprocal once.
+
+Parsing reads eight digits at a time by loading them as one 64 bit word and combining the digits pairwise with three multiplications (SWAR, SIMD within a register). The number of leading digits in a word is found by classifying all eight characters at once. Runs shorter than eight digits and the end of the text are read one digit at a time.
+
+Formatting converts two digits at a time using a lookup table of all digit pairs from 00 to 99, which halves the number of divisions compared to converting one digit at a time.
+
+*/
+
+typedef struct {
+  i64 value;
+  i16 exponent;
+} Number;
+
+typedef struct {
+  u8 truncate;
+  u8 half_up;
+  u8 half_even;
+} RoundingModes;
+
+// Rounding of the last decimal in a division
+const RoundingModes rounding_modes = {
+  .truncate = 0,
+  .half_up = 1, // ties are rounded away from zero
+  .half_even = 2 // ties are rounded to the even neighbour
+};
+
+// Precomputed multiply-shift reciprocal of a divisor
+typedef struct {
+  u64 divisor;
+  u64 multiplier;
+  u8 shift;
+} Reciprocal;
+
+// Largest number of decimals a division can be asked for
+const i32 MAX_DIVISION_PRECISION = 18;
+
+// Number of reciprocals kept in the reciprocal cache
+#define RECIPROCAL_CACHE_SIZE 64
+
+// Longest possible text of a number: sign, 20 digits, decimal point, a leading zero and up to 32768 zeros of exponent padding
+#define NUMBER_TEXT_SIZE 32792
+
+static const u64 powers_of_ten[20] = {
+  1u,
+  10u,
+  100u,
+  1000u,
+  10000u,
+  100000u,
+  1000000u,
+  10000000u,
+  100000000u,
+  1000000000u,
+  10000000000u,
+  100000000000u,
+  1000000000000u,
+  10000000000000u,
+  100000000000000u,
+  1000000000000000u,
+  10000000000000000u,
+  100000000000000000u,
+  1000000000000000000u,
+  10000000000000000000u
+};
+
+static Reciprocal reciprocal_cache[RECIPROCAL_CACHE_SIZE];
+
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Finds the index of the lowest set bit
+static i32 lowest_bit(u64 bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(bits);
+#else
+  i32 index = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    index += 1;
+  }
+  return index;
+#endif
+}
+
+// Converts eight digit values, the first one in the lowest byte, to a number
+static u64 combine_eight_digits(u64 digits) {
+  digits = digits * 10 + (digits >> 8); // Pairs of digits
+  return (((digits & 0x000000FF000000FFu) * 0x000F424000000064u) + (((digits >> 16) & 0x000000FF000000FFu) * 0x0000271000000001u)) >> 32;
+}
+
+// Reads a run of digits, appends them to value and returns the number of digits read
+static i64 parse_digits(const u8 *text, i64 length, u64 *value) {
+  i64 position = 0;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (length - position >= 8) {
+    u64 chunk = 0;
+    memcpy(&chunk, text + position, 8);
+    // Each byte is 0 for a digit: the high nibble has to be 3 both before and after adding 6
+    u64 non_digits = ((chunk & 0xF0F0F0F0F0F0F0F0u) | (((chunk + 0x0606060606060606u) & 0xF0F0F0F0F0F0F0F0u) >> 4)) ^ 0x3333333333333333u;
+    i32 digit_count = non_digits == 0 ? 8 : lowest_bit(non_digits) / 8;
+    if (digit_count == 0) return position;
+    // Shift out the characters after the digits, which leaves leading zeros
+    chunk = (chunk - 0x3030303030303030u) << (8 * (8 - digit_count));
+    *value = *value * powers_of_ten[digit_count] + combine_eight_digits(chunk);
+    position += digit_count;
+    if (digit_count < 8) return position;
+  }
+#endif
+  while (position < length && text[position] >= '0' && text[position] <= '9') {
+    *value = *value * 10 + (text[position] - '0');
+    position += 1;
+  }
+  return position;
+}
+
+// number_parse: reads a number from decimal text and returns the number of characters read
+// The text may start with a minus sign. Digits after a decimal point lower the exponent.
+i64 number_parse(const u8 *text, i64 length, Number *number) {
+  u64 value = 0;
+  i32 exponent = 0;
+  i64 position = 0;
+  bool negative = length > 0 && text[0] == '-';
+  position += negative ? 1 : 0;
+  position += parse_digits(text + position, length - position, &value);
+  while (position < length && text[position] == '.') {
+    position += 1;
+    i64 decimals = parse_digits(text + position, length - position, &value);
+    position += decimals;
+    exponent -= (i32)decimals;
+  }
+  number->value = negative ? -(i64)value : (i64)value;
+  number->exponent = (i16)exponent;
+  return position;
+}
+
+// number_format: writes a number as decimal text into a buffer and returns the text length
+// Trailing decimal zeros are left out, so 30 * 10^-2 is written as 0.3. The text is not null terminated.
+i32 number_format(Number number, char *buffer) {
+  // Write the digits of the magnitude backwards into a scratch buffer, two at a time
+  char digits[20];
+  i32 digit_start = 20;
+  u64 magnitude = number.value < 0 ? (u64)0 - (u64)number.value : (u64)number.value;
+  while (magnitude >= 100) {
+    u64 pair = (magnitude % 100) * 2;
+    magnitude /= 100;
+    digit_start -= 2;
+    digits[digit_start] = digit_pairs[pair];
+    digits[digit_start + 1] = digit_pairs[pair + 1];
+  }
+  if (magnitude >= 10) {
+    digit_start -= 2;
+    digits[digit_start] = digit_pairs[magnitude * 2];
+    digits[digit_start + 1] = digit_pairs[magnitude * 2 + 1];
+  } else {
+    digit_start -= 1;
+    digits[digit_start] = (char)('0' + magnitude);
+  }
+  i32 digit_count = 20 - digit_start;
+
+  // Drop trailing decimal zeros
+  i32 decimals = number.exponent < 0 ? -number.exponent : 0;
+  while (decimals > 0 && digit_count > 1 && digits[digit_start + digit_count - 1] == '0') {
+    digit_count -= 1;
+    decimals -= 1;
+  }
+  if (number.value == 0) {
+    decimals = 0;
+  }
+
+  i32 length = 0;
+  if (number.value < 0) {
+    buffer[length++] = '-';
+  }
+  if (decimals == 0) {
+    memcpy(buffer + length, digits + digit_start, digit_count);
+    length += digit_count;
+    // Positive exponents are written as trailing zeros
+    for (i32 i = 0; number.value != 0 && i < number.exponent; i++) {
+      buffer[length++] = '0';
+    }
+  } else if (digit_count > decimals) {
+    i32 integer_digits = digit_count - decimals;
+    memcpy(buffer + length, digits + digit_start, integer_digits);
+    length += integer_digits;
+    buffer[length++] = '.';
+    memcpy(buffer + length, digits + digit_start + integer_digits, decimals);
+    length += decimals;
+  } else {
+    buffer[length++] = '0';
+    buffer[length++] = '.';
+    for (i32 i = digit_count; i < decimals; i++) {
+      buffer[length++] = '0';
+    }
+    memcpy(buffer + length, digits + digit_start, digit_count);
+    length += digit_count;
+  }
+  return length;
+}
+
+// number_compact: removes trailing decimal zeros from a number
+// Integers are kept at exponent 0
+Number number_compact(Number number) {
+  while (number.exponent < 0 && number.value % 10 == 0 && number.value != 0) {
+    number.value /= 10;
+    number.exponent += 1;
+  }
+  return number;
+}
+
+// Multiplies a value by 10^digits, wrapping around on overflow like the rest of the arithmetic
+static i64 scale_up(i64 value, i32 digits) {
+  u64 scaled = (u64)value;
+  while (digits > 19) {
+    scaled *= powers_of_ten[19];
+    digits -= 19;
+  }
+  return (i64)(scaled * powers_of_ten[digits]);
+}
+
+// number_align: rewrites two numbers to the lowest of their exponents
+void number_align(Number *a, Number *b) {
+  if (a->exponent < b->exponent) {
+    b->value = scale_up(b->value, b->exponent - a->exponent);
+    b->exponent = a->exponent;
+  } else if (a->exponent > b->exponent) {
+    a->value = scale_up(a->value, a->exponent - b->exponent);
+    a->exponent = b->exponent;
+  }
+}
+
+// number_add: adds two numbers
+Number number_add(Number a, Number b) {
+  number_align(&a, &b);
+  a.value = (i64)((u64)a.value + (u64)b.value);
+  return a;
+}
+
+// number_subtract: subtracts b from a
+Number number_subtract(Number a, Number b) {
+  number_align(&a, &b);
+  a.value = (i64)((u64)a.value - (u64)b.value);
+  return a;
+}
+
+// number_multiply: multiplies two numbers, which needs no alignment as the exponents add up
+Number number_multiply(Number a, Number b) {
+  a.value = (i64)((u64)a.value * (u64)b.value);
+  a.exponent += b.exponent;
+  return a;
+}
+
+// number_compare: returns -1, 0 or 1 when a is less than, equal to or greater than b
+i32 number_compare(Number a, Number b) {
+  number_align(&a, &b);
+  return (a.value > b.value) - (a.value < b.value);
+}
+
+// Returns the high 64 bits of the 128 bit product of a and b
+static u64 multiply_high(u64 a, u64 b) {
+#ifdef __SIZEOF_INT128__
+  return (u64)(((unsigned __int128)a * b) >> 64);
+#else
+  u64 a_low = (u32)a;
+  u64 a_high = a >> 32;
+  u64 b_low = (u32)b;
+  u64 b_high = b >> 32;
+  u64 low_low = a_low * b_low;
+  u64 low_high = a_low * b_high;
+  u64 high_low = a_high * b_low;
+  u64 middle = (low_low >> 32) + (u32)low_high + (u32)high_low;
+  return a_high * b_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+#endif
+}
+
+// reciprocal_create: precomputes the multiply-shift reciprocal of a divisor larger than 0
+// The multiplier is floor(2^64 * (2^shift - divisor) / divisor) + 1, where 2^shift is the smallest power of two that is at least the divisor
+Reciprocal reciprocal_create(u64 divisor) {
+  Reciprocal reciprocal = {.divisor = divisor, .multiplier = 0, .shift = 0};
+  if (divisor == 1) return reciprocal;
+  while (reciprocal.shift < 64 && ((u64)1 << reciprocal.shift) < divisor) {
+    reciprocal.shift += 1;
+  }
+  u64 remainder = reciprocal.shift == 64 ? 0 - divisor : ((u64)1 << reciprocal.shift) - divisor;
+  // Shift-subtract division of remainder * 2^64 by the divisor, one bit at a time
+  u64 quotient = 0;
+  for (i32 i = 0; i < 64; i++) {
+    bool carry = remainder >> 63;
+    remainder <<= 1;
+    quotient <<= 1;
+    if (carry || remainder >= divisor) {
+      remainder -= divisor;
+      quotient |= 1;
+    }
+  }
+  reciprocal.multiplier = quotient + 1;
+  return reciprocal;
+}
+
+// reciprocal_divide: divides by multiplying with a precomputed reciprocal
+u64 reciprocal_divide(Reciprocal *reciprocal, u64 dividend) {
+  if (reciprocal->shift == 0) return dividend;
+  u64 high = multiply_high(reciprocal->multiplier, dividend);
+  return (high + ((dividend - high) >> 1)) >> (reciprocal->shift - 1);
+}
+
+// Returns the cached reciprocal of a divisor, computing it if the cache slot holds another divisor
+static Reciprocal *reciprocal_lookup(u64 divisor) {
+  Reciprocal *reciprocal = &reciprocal_cache[(divisor ^ (divisor >> 7)) % RECIPROCAL_CACHE_SIZE];
+  if (reciprocal->divisor != divisor) {
+    *reciprocal = reciprocal_create(divisor);
+  }
+  return reciprocal;
+}
+
+// number_divide: divides a by b and keeps precision decimals more than the most precise of them
+// The last decimal is rounded using one of the rounding modes. Division by zero gives 0.
+Number number_divide(Number a, Number b, i32 precision, u8 rounding) {
+  Number result = {.value = 0, .exponent = 0};
+  if (b.value == 0) return result;
+  a = number_compact(a);
+  b = number_compact(b);
+  bool negative = (a.value < 0) != (b.value < 0);
+  u64 numerator = a.value < 0 ? (u64)0 - (u64)a.value : (u64)a.value;
+  u64 denominator = b.value < 0 ? (u64)0 - (u64)b.value : (u64)b.value;
+  i32 decimals = precision + (a.exponent < b.exponent ? -a.exponent : -b.exponent);
+  // The quotient is numerator * 10^scale / denominator
+  i32 scale = a.exponent - b.exponent + decimals;
+  if (scale < 0) {
+    // A denominator that doesn't fit 64 bits when scaled is larger than any numerator
+    if (-scale >= 20 || denominator > UINT64_MAX / powers_of_ten[-scale]) return result;
+    denominator *= powers_of_ten[-scale];
+    scale = 0;
+  }
+  u64 quotient = 0;
+  u64 remainder = 0;
+  if (scale < 20 && numerator <= UINT64_MAX / powers_of_ten[scale]) {
+    numerator *= powers_of_ten[scale];
+    quotient = reciprocal_divide(reciprocal_lookup(denominator), numerator);
+    remainder = numerator - quotient * denominator;
+  } else {
+    // Long division one decimal at a time when the scaled numerator doesn't fit 64 bits
+    quotient = numerator / denominator;
+    remainder = numerator % denominator;
+    for (i32 i = 0; i < scale; i++) {
+      // Multiply the remainder by ten as ten additions, splitting off the next digit without overflowing
+      u64 digit = 0;
+      u64 next = 0;
+      for (i32 j = 0; j < 10; j++) {
+        if (next >= denominator - remainder) {
+          next -= denominator - remainder;
+          digit += 1;
+        } else {
+          next += remainder;
+        }
+      }
+      quotient = quotient * 10 + digit;
+      remainder = next;
+    }
+  }
+  if (rounding == rounding_modes.half_up && remainder >= denominator - remainder) {
+    quotient += 1;
+  } else if (rounding == rounding_modes.half_even && (remainder > denominator - remainder || (remainder == denominator - remainder && (quotient & 1)))) {
+    quotient += 1;
+  }
+  result.value = negative ? -(i64)quotient : (i64)quotient;
+  result.exponent = -decimals;
+  return number_compact(result);
+}
+
+#define C9_NUMBER
+#endif
\ No newline at end of file
@@ -0,0 +1,1964 @@
+#ifndef TARZAN_IR
+
+/*
+
+Intermediate representation between the statement tree of the compiler and the instructions of the machine. It has the following functions:
+- generate_function: translates the statements of the program or of a snippet instance into instructions
+
+A function, which is the program itself or a snippet instance that is called, is first translated into basic blocks of values in static single assignment form. Every value is computed by one instruction and never changes, and a variable is only a name for the value it was given last. Where blocks join, a phi value takes the value a variable has in the block that ran before. The form is built straight from the tree: the value of a variable is looked up in the blocks before the current one when it's read, and the blocks of a loop get their phis once the end of the loop is known. Small snippets are built in place of their calls, like before.
+
+The passes over that form are:
+- Copy propagation, which comes for free: `a = b` makes a a name for the value of b and generates nothing, and a phi that takes the same value from every block is replaced by that value.
+- Common subexpression elimination, which gives an operation the value of an equal operation on the same values in a block that always runs before it, so `x = i * j; y = i * j + 1` multiplies once. Divisions are only shared when the file never changes the precision or rounding.
+- Strength reduction of induction variables, which are the variables a loop changes by the same step in every iteration. A product of one with a value that is the same in every iteration becomes an induction variable of its own, so `i * j` in a loop over j is a sum that grows by i each iteration. A loop whose condition is all its counter is still used for besides sums with such values compares one of the sums instead, and the counter disappears. The start, step and bound of the counter are kept with the loop, which makes the number of iterations of a counted loop known.
+- Closed forms of counted loops that have no effects and only change induction variables and sums of them, like `while (i < n) { sum = sum + i; i = i + 1; }`. An op_series instruction before such a loop gives its variables the values they have after the last iteration, and the condition of the loop then ends it right away.
+- Unrolling of small counted loops that still have to run, whose body is repeated UNROLL_FACTOR times between tests of the condition. The repeated loop runs while the counter would still meet the condition after the repeated iterations, against a bound that is computed once before it, and the loop itself runs the iterations that remain after it.
+- Dead code elimination, which removes every value that nothing prints, compares or passes on.
+- Dead store elimination, which follows from the other passes: a variable that is assigned again before it's read has its first value removed, and only the variables a snippet can see are written to their registers for it.
+
+Then every value gets a register, going through the blocks so that a block comes after the blocks that always run before it. A value takes the register of the first variable it's assigned to when no other value in use is in it, and the lowest free temporary register otherwise. Phis become moves at the end of the blocks before them, and most of those moves disappear because the values on both sides got the register of the same variable. The blocks are laid out in the order they were built, so loops still test their condition at the bottom.
+
+Snippet instances share their variables with the caller through the registers of those variables. Before a call the variables visible in the instance are moved to their registers if their value is somewhere else, and after the call they are read from their registers again. An instance may use any temporary register, so no value stays in a temporary across a call; a function that would need that is left to the interpreter. A region of the interpreter hands its variables back the same way when it halts, see compile_region.
+
+*/
+
+typedef struct {
+  u8 constant;
+  u8 load;
+  u8 phi;
+  u8 add;
+  u8 subtract;
+  u8 multiply;
+  u8 divide;
+  u8 negate;
+  u8 print;
+  u8 precision;
+  u8 rounding;
+  u8 call;
+} ValueCodes;
+
+const ValueCodes value_codes = {
+  .constant = 1, // register that is never written
+  .load = 2, // value of a variable in its register when a function starts or a call returns
+  .phi = 3, // value of a variable where blocks join, with an operand for each predecessor
+  .add = 4,
+  .subtract = 5,
+  .multiply = 6,
+  .divide = 7,
+  .negate = 8,
+  .print = 9,
+  .precision = 10,
+  .rounding = 11,
+  .call = 12
+};
+
+typedef struct {
+  u8 jump;
+  u8 branch;
+  u8 exit;
+} BlockEnds;
+
+const BlockEnds block_ends = {
+  .jump = 1, // continue at the first successor
+  .branch = 2, // continue at the first successor if the condition holds and at the second one otherwise
+  .exit = 3 // halt the program or return from the instance
+};
+
+typedef struct {
+  u8 code;
+  bool live; // Set when the value is used, or when the instruction has an effect
+  u8 dying; // Operands this instruction uses for the last time: 1 for the left one and 2 for the right one
+  i32 block;
+  i32 left; // Operand values, -1 if there are none
+  i32 right;
+  i32 variable; // Variable of a load or phi, or the first variable the value is assigned to, -1 if none
+  i32 reg; // Register of the value
+  i32 setting; // Precision or rounding setting
+  i32 replacement; // Value that replaces this one, the value itself if none
+  Number number; // Value of a constant
+  Instance *instance; // Called instance
+  Array *operands; // Values of a phi, in the order of the predecessors of its block
+  Array *syncs; // Variables that are moved to their registers before a call
+} Value;
+
+typedef struct {
+  Array *header; // Phis and loads, which all get their value when the block starts
+  Array *code; // Other values, in the order they run
+  Array *predecessors;
+  i32 successors[2];
+  i32 successor_count;
+  u8 end;
+  u8 comparator; // Comparator of a branch
+  i32 left; // Values a branch compares
+  i32 right;
+  bool sealed; // Set once all predecessors are known
+  bool reloads; // Set when the variables are read from their registers: the first block of a function and the blocks after calls
+  Array *incomplete; // Phis added before the block was sealed, which get their operands when it is
+  Array *copies; // Moves at the end of the block that give the phis of its successor their values
+  i32 order; // Position in reverse postorder, -1 until the block is found to be reachable
+  i32 dominator; // Closest other block that every path to this one goes through
+  i32 first_child; // First block this one is the dominator of, -1 if none
+  i32 next_sibling; // Next block with the same dominator, -1 if none
+  i32 search; // Next successor or child to visit while searching the blocks
+  i32 dominator_start; // Numbers from a walk of the dominator tree, a block dominates the blocks whose numbers are in its range
+  i32 dominator_end;
+  u64 *uses; // Values used before they are defined in the block, as a bitset
+  u64 *defines; // Values defined in the block
+  u64 *live_in; // Values that are used after the block starts
+  u64 *live_out; // Values that are used after the block ends
+  i32 address; // First instruction of the block
+  i32 closed_form; // Loop whose values after it are computed at the end of the block, -1 if none
+} Block;
+
+// Register that gets the value of another one
+typedef struct {
+  i32 destination;
+  i32 source;
+} Copy;
+
+// Variable that has to hold a value in its register
+typedef struct {
+  i32 variable;
+  i32 value;
+} Sync;
+
+// Operation that was already computed, for common subexpression elimination
+typedef struct {
+  u8 code;
+  i32 left;
+  i32 right;
+  i32 value;
+  i32 next; // Entry with the same hash that was added before, -1 if none
+} Available;
+
+// Jump whose target is the address of a block
+typedef struct {
+  i32 instruction;
+  i32 block;
+} Fixup;
+
+// Value that changes by the same step in every iteration of a loop
+typedef struct {
+  i32 phi; // Value in the loop header, -1 if there is none
+  i32 start; // Value before the loop
+  i32 step; // Value that is the same in every iteration
+  u8 code; // value_codes.add or value_codes.subtract, for how the step is applied at the end of an iteration
+} Induction;
+
+// Loop whose header is only entered from the block before it and from the end of its body
+typedef struct {
+  i32 header; // Block that tests the condition and has the phis
+  i32 preheader; // Block before the loop, which only continues at the header
+  i32 latch; // Block at the end of the body
+  i32 latch_edge; // Position of the latch in the predecessors of the header
+  Array *blocks; // Blocks of the loop, starting with the header
+  Induction counter; // Induction variable the condition compares, its phi is -1 when the number of iterations isn't known
+  i32 bound; // Value the counter is compared to, which is the same in every iteration
+  u8 comparator; // The loop goes on while `counter comparator bound` holds
+  Array *terms; // Terms of the closed form of the loop, with values instead of registers, 0 if the loop has to run
+} Loop;
+
+i32 added_start = 0; // First register added by the optimizer
+i32 temporary_start = 0; // First temporary register, which is kept free for moves that swap registers
+i32 temporary_count = 0; // Number of temporary registers the generated functions use
+i32 inline_depth = 0; // Number of snippet bodies being built in place of their calls
+
+// State of the function being generated
+Array *function_values = 0;
+Array *function_blocks = 0;
+Array *block_layout = 0; // Blocks in the order their instructions are generated
+Array *block_order = 0; // Reachable blocks in reverse postorder
+Array *exit_syncs = 0; // Variables an instance hands back to its caller, or a region to the interpreter
+Array *written_added = 0; // Added registers the function assigns
+i32 current_block = 0;
+i32 *constant_values = 0; // Value of each constant register, -1 until it's used
+i32 set_words = 0; // Number of words in a bitset of values
+i32 *occupied = 0; // Registers in use, marked with the current occupation stamp
+i32 occupation_stamp = 0;
+Array *function_loops = 0; // Loops that were found, inner loops first
+i32 *loop_marks = 0; // Blocks of the loop being optimized, marked with the current loop stamp
+i32 loop_stamp = 0;
+
+// Hash table of the value each block gives each variable, only used while building
+i64 *definition_keys = 0;
+i32 *definition_values = 0;
+i64 definition_size = 0;
+i64 definition_count = 0;
+
+Value *value_at(i32 id) {
+  return (Value *)array_get(function_values, id);
+}
+
+Block *block_at(i32 id) {
+  return (Block *)array_get(function_blocks, id);
+}
+
+i32 item_at(Array *array, i32 index) {
+  return *(i32 *)array_get(array, index);
+}
+
+// Places a register added by the optimizer after all other registers
+i32 place_register(i32 reg) {
+  return reg < 0 ? added_start - 1 - reg : reg;
+}
+
+// Follows the replacements of a value to the value that is left
+i32 resolve_value(i32 id) {
+  while (id >= 0 && value_at(id)->replacement != id) {
+    id = value_at(id)->replacement;
+  }
+  return id;
+}
+
+bool is_tracked(i32 id) {
+  return id >= 0 && value_at(id)->code != value_codes.constant;
+}
+
+bool set_has(u64 *set, i32 index) {
+  return (set[index >> 6] >> (index & 63)) & 1;
+}
+
+void set_add(u64 *set, i32 index) {
+  set[index >> 6] |= (u64)1 << (index & 63);
+}
+
+void set_remove(u64 *set, i32 index) {
+  set[index >> 6] &= ~((u64)1 << (index & 63));
+}
+
+u64 *new_set() {
+  u64 *set = (u64 *)arena_fill(arena, set_words * sizeof(u64) + sizeof(u64));
+  memset(set, 0, set_words * sizeof(u64) + sizeof(u64));
+  return set;
+}
+
+i64 definition_slot(i64 key) {
+  return (i64)(((u64)key * 0x9E3779B97F4A7C15u) >> 17) & (definition_size - 1);
+}
+
+// Moves the definitions to a table of a new size
+void resize_definitions(i64 size) {
+  i64 *old_keys = definition_keys;
+  i32 *old_values = definition_values;
+  i64 old_size = definition_size;
+  definition_size = size;
+  definition_keys = malloc(size * sizeof(i64));
+  definition_values = malloc(size * sizeof(i32));
+  if (definition_keys == NULL || definition_values == NULL) {
+    printf("Memory allocation failed in resize_definitions\n");
+    exit(1);
+  }
+  for (i64 i = 0; i < size; i++) {
+    definition_keys[i] = -1;
+  }
+  for (i64 i = 0; i < old_size; i++) {
+    if (old_keys[i] == -1) continue;
+    i64 slot = definition_slot(old_keys[i]);
+    while (definition_keys[slot] != -1) {
+      slot = (slot + 1) & (size - 1);
+    }
+    definition_keys[slot] = old_keys[i];
+    definition_values[slot] = old_values[i];
+  }
+  free(old_keys);
+  free(old_values);
+}
+
+// Returns the value a block last gave a variable, -1 if the block doesn't give it one
+i32 find_definition(i32 block, i32 variable) {
+  i64 key = ((i64)block << 32) | (u32)variable;
+  i64 slot = definition_slot(key);
+  while (definition_keys[slot] != -1) {
+    if (definition_keys[slot] == key) return definition_values[slot];
+    slot = (slot + 1) & (definition_size - 1);
+  }
+  return -1;
+}
+
+void set_definition(i32 block, i32 variable, i32 value) {
+  if ((definition_count + 1) * 2 > definition_size) {
+    resize_definitions(definition_size * 2);
+  }
+  i64 key = ((i64)block << 32) | (u32)variable;
+  i64 slot = definition_slot(key);
+  while (definition_keys[slot] != -1 && definition_keys[slot] != key) {
+    slot = (slot + 1) & (definition_size - 1);
+  }
+  if (definition_keys[slot] == -1) {
+    definition_keys[slot] = key;
+    definition_count += 1;
+  }
+  definition_values[slot] = value;
+}
+
+i32 new_value(u8 code, i32 block) {
+  Value value;
+  memset(&value, 0, sizeof(Value));
+  value.code = code;
+  value.block = block;
+  value.left = -1;
+  value.right = -1;
+  value.variable = -1;
+  value.reg = -1;
+  value.replacement = array_length(function_values);
+  array_push(function_values, &value);
+  return value.replacement;
+}
+
+// Adds an instruction to the end of the current block
+i32 add_value(u8 code, i32 left, i32 right) {
+  i32 id = new_value(code, current_block);
+  Value *value = value_at(id);
+  value->left = left;
+  value->right = right;
+  array_push(block_at(current_block)->code, &id);
+  return id;
+}
+
+// Adds a phi or load of a variable to the start of a block
+i32 add_header_value(u8 code, i32 variable, i32 block) {
+  i32 id = new_value(code, block);
+  Value *value = value_at(id);
+  value->variable = variable;
+  if (code == value_codes.phi) {
+    value->operands = array_create(arena, sizeof(i32));
+  }
+  array_push(block_at(block)->header, &id);
+  return id;
+}
+
+i32 new_block() {
+  Block block;
+  memset(&block, 0, sizeof(Block));
+  block.header = array_create(arena, sizeof(i32));
+  block.code = array_create(arena, sizeof(i32));
+  block.predecessors = array_create(arena, sizeof(i32));
+  block.incomplete = array_create(arena, sizeof(i32));
+  block.copies = array_create(arena, sizeof(Copy));
+  block.successors[0] = -1;
+  block.successors[1] = -1;
+  block.left = -1;
+  block.right = -1;
+  block.order = -1;
+  block.dominator = -1;
+  block.first_child = -1;
+  block.next_sibling = -1;
+  block.closed_form = -1;
+  array_push(function_blocks, &block);
+  return array_last(function_blocks);
+}
+
+void add_edge(i32 from, i32 to) {
+  Block *block = block_at(from);
+  block->successors[block->successor_count] = to;
+  block->successor_count += 1;
+  array_push(block_at(to)->predecessors, &from);
+}
+
+// Ends the current block with a jump to another one
+void jump_to(i32 target) {
+  block_at(current_block)->end = block_ends.jump;
+  add_edge(current_block, target);
+}
+
+// Makes a block the one new instructions are added to, and the next one in the layout
+void start_block(i32 block) {
+  current_block = block;
+  array_push(block_layout, &block);
+}
+
+// Replaces a phi by the one value it takes besides itself, and returns the value that is left
+i32 remove_trivial_phi(i32 phi) {
+  Value *value = value_at(phi);
+  i32 same = -1;
+  for (i32 i = 0; i < array_length(value->operands); i++) {
+    i32 operand = resolve_value(item_at(value->operands, i));
+    if (operand == phi || operand == same) continue;
+    if (same >= 0) return phi;
+    same = operand;
+  }
+  // A phi that only takes itself is in a block that can't be reached
+  if (same < 0) return phi;
+  value->replacement = same;
+  return same;
+}
+
+i32 read_variable(i32 variable, i32 block);
+
+// Gives a phi the value its variable has at the end of each predecessor
+i32 add_phi_operands(i32 phi) {
+  Value *value = value_at(phi);
+  Block *block = block_at(value->block);
+  for (i32 i = 0; i < array_length(block->predecessors); i++) {
+    i32 operand = read_variable(value->variable, item_at(block->predecessors, i));
+    array_push(value->operands, &operand);
+  }
+  return remove_trivial_phi(phi);
+}
+
+// Returns the value a variable has at the end of a block, adding phis and loads where needed
+i32 read_variable(i32 variable, i32 block_id) {
+  i32 value = find_definition(block_id, variable);
+  if (value >= 0) return resolve_value(value);
+  Block *block = block_at(block_id);
+  if (block->reloads) {
+    value = add_header_value(value_codes.load, variable, block_id);
+  } else if (!block->sealed) {
+    value = add_header_value(value_codes.phi, variable, block_id);
+    array_push(block->incomplete, &value);
+  } else if (array_length(block->predecessors) == 1) {
+    value = read_variable(variable, item_at(block->predecessors, 0));
+  } else {
+    // The phi is the value of the variable while its operands are read, which ends loops through the block
+    value = add_header_value(value_codes.phi, variable, block_id);
+    set_definition(block_id, variable, value);
+    value = add_phi_operands(value);
+  }
+  set_definition(block_id, variable, value);
+  return value;
+}
+
+// Marks that all predecessors of a block are known and completes its phis
+void seal_block(i32 block_id) {
+  Block *block = block_at(block_id);
+  for (i32 i = 0; i < array_length(block->incomplete); i++) {
+    add_phi_operands(item_at(block->incomplete, i));
+  }
+  block->sealed = true;
+}
+
+i32 build_expression(Expression *expression) {
+  if (expression->kind == expression_kinds.constant) {
+    i32 reg = place_register(expression->reg);
+    if (constant_values[reg] < 0) {
+      i32 id = new_value(value_codes.constant, -1);
+      Value *value = value_at(id);
+      value->reg = reg;
+      value->number = expression->value;
+      constant_values[reg] = id;
+    }
+    return constant_values[reg];
+  } else if (expression->kind == expression_kinds.variable) {
+    return read_variable(place_register(expression->reg), current_block);
+  } else if (expression->kind == expression_kinds.negation) {
+    return add_value(value_codes.negate, build_expression(expression->left), -1);
+  }
+  i32 left = build_expression(expression->left);
+  i32 right = build_expression(expression->right);
+  u8 code = value_codes.add;
+  if (expression->op_code == operators.minus) {
+    code = value_codes.subtract;
+  } else if (expression->op_code == operators.multiply) {
+    code = value_codes.multiply;
+  } else if (expression->op_code == operators.divide) {
+    code = value_codes.divide;
+  }
+  return add_value(code, left, right);
+}
+
+// Ends the current block with a branch on the condition of a statement, whose successors are already added
+void build_condition(Statement *statement) {
+  i32 left = build_expression(statement->value);
+  i32 right = build_expression(statement->right);
+  Block *block = block_at(current_block);
+  block->end = block_ends.branch;
+  block->comparator = statement->comparator;
+  block->left = left;
+  block->right = right;
+}
+
+// Returns the values the variables of a scope have at the end of the current block, and those of the added registers the function assigns if added is true
+Array *collect_syncs(Binding *binding, bool added) {
+  Array *syncs = array_create(arena, sizeof(Sync));
+  while (binding != 0) {
+    Sync sync = {.variable = binding->reg, .value = read_variable(binding->reg, current_block)};
+    array_push(syncs, &sync);
+    binding = binding->previous;
+  }
+  for (i32 i = 0; added && i < array_length(written_added); i++) {
+    i32 variable = item_at(written_added, i);
+    Sync sync = {.variable = variable, .value = read_variable(variable, current_block)};
+    array_push(syncs, &sync);
+  }
+  return syncs;
+}
+
+// Counts the statements in a list, including the ones nested in blocks
+i32 count_statements(Statement *statement) {
+  i32 count = 0;
+  while (statement != 0) {
+    count += 1 + count_statements(statement->body) + count_statements(statement->otherwise);
+    statement = statement->next;
+  }
+  return count;
+}
+
+void build_statements(Statement *statement) {
+  while (statement != 0) {
+    if (statement->kind == statement_kinds.assign) {
+      i32 variable = place_register(statement->reg);
+      i32 id = build_expression(statement->value);
+      Value *value = value_at(id);
+      if (value->code != value_codes.constant && value->variable < 0) {
+        value->variable = variable;
+      }
+      set_definition(current_block, variable, id);
+      if (statement->binding == 0) {
+        bool known = false;
+        for (i32 i = 0; i < array_length(written_added); i++) {
+          known |= item_at(written_added, i) == variable;
+        }
+        if (!known) {
+          array_push(written_added, &variable);
+        }
+      }
+    } else if (statement->kind == statement_kinds.print) {
+      add_value(value_codes.print, build_expression(statement->value), -1);
+    } else if (statement->kind == statement_kinds.loop) {
+      // The condition block comes after the body, so each iteration ends with a single jump back to the body
+      i32 body = new_block();
+      i32 condition = new_block();
+      i32 exit = new_block();
+      jump_to(condition);
+      add_edge(condition, body);
+      add_edge(condition, exit);
+      seal_block(body);
+      start_block(body);
+      build_statements(statement->body);
+      jump_to(condition);
+      start_block(condition);
+      build_condition(statement);
+      seal_block(condition);
+      seal_block(exit);
+      start_block(exit);
+    } else if (statement->kind == statement_kinds.branch) {
+      build_condition(statement);
+      i32 branch = current_block;
+      i32 body = new_block();
+      i32 otherwise = statement->otherwise != 0 ? new_block() : -1;
+      i32 join = new_block();
+      add_edge(branch, body);
+      add_edge(branch, otherwise >= 0 ? otherwise : join);
+      seal_block(body);
+      start_block(body);
+      build_statements(statement->body);
+      jump_to(join);
+      if (otherwise >= 0) {
+        seal_block(otherwise);
+        start_block(otherwise);
+        build_statements(statement->otherwise);
+        jump_to(join);
+      }
+      seal_block(join);
+      start_block(join);
+    } else if (statement->kind == statement_kinds.block) {
+      build_statements(statement->body);
+    } else if (statement->kind == statement_kinds.call) {
+      Instance *instance = statement->instance;
+      if (!instance->inlining && inline_depth < MAX_INLINE_DEPTH && count_statements(instance->body) <= MAX_INLINE_STATEMENTS) {
+        // A small snippet runs without a call, unless it uses itself
+        instance->inlining = true;
+        inline_depth += 1;
+        build_statements(instance->body);
+        inline_depth -= 1;
+        instance->inlining = false;
+      } else {
+        Array *syncs = collect_syncs(instance->scope, true);
+        Value *call = value_at(add_value(value_codes.call, -1, -1));
+        call->instance = instance;
+        call->syncs = syncs;
+        instance->called = true;
+        i32 after = new_block();
+        block_at(after)->reloads = true;
+        jump_to(after);
+        seal_block(after);
+        start_block(after);
+      }
+    } else if (statement->kind == statement_kinds.precision || statement->kind == statement_kinds.rounding) {
+      Value *value = value_at(add_value(statement->kind == statement_kinds.precision ? value_codes.precision : value_codes.rounding, -1, -1));
+      value->setting = statement->reg;
+    }
+    statement = statement->next;
+  }
+}
+
+// Replaces phis that take only one value until none are left
+void remove_trivial_phis() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (i32 i = 0; i < array_length(function_values); i++) {
+      Value *value = value_at(i);
+      if (value->code == value_codes.phi && value->replacement == i && remove_trivial_phi(i) != i) {
+        changed = true;
+      }
+    }
+  }
+}
+
+i32 intersect_dominators(i32 a, i32 b) {
+  while (a != b) {
+    while (block_at(a)->order > block_at(b)->order) {
+      a = block_at(a)->dominator;
+    }
+    while (block_at(b)->order > block_at(a)->order) {
+      b = block_at(b)->dominator;
+    }
+  }
+  return a;
+}
+
+// Orders the reachable blocks in reverse postorder and finds the dominator of each block
+void order_blocks() {
+  i32 block_count = array_length(function_blocks);
+  // Loop unrolling adds blocks, after which the blocks are ordered again
+  for (i32 i = 0; i < block_count; i++) {
+    Block *block = block_at(i);
+    block->order = -1;
+    block->dominator = -1;
+    block->first_child = -1;
+    block->next_sibling = -1;
+  }
+  i32 *stack = malloc(block_count * sizeof(i32));
+  i32 *postorder = malloc(block_count * sizeof(i32));
+  if (stack == NULL || postorder == NULL) {
+    printf("Memory allocation failed in order_blocks\n");
+    exit(1);
+  }
+  i32 stack_length = 1;
+  i32 postorder_length = 0;
+  stack[0] = 0;
+  block_at(0)->order = 0;
+  block_at(0)->search = 0;
+  while (stack_length > 0) {
+    Block *block = block_at(stack[stack_length - 1]);
+    if (block->search < block->successor_count) {
+      i32 successor = block->successors[block->search];
+      block->search += 1;
+      if (block_at(successor)->order < 0) {
+        block_at(successor)->order = 0;
+        block_at(successor)->search = 0;
+        stack[stack_length] = successor;
+        stack_length += 1;
+      }
+    } else {
+      stack_length -= 1;
+      postorder[postorder_length] = stack[stack_length];
+      postorder_length += 1;
+    }
+  }
+  block_order = array_create(arena, sizeof(i32));
+  for (i32 i = postorder_length - 1; i >= 0; i--) {
+    block_at(postorder[i])->order = array_length(block_order);
+    array_push(block_order, &postorder[i]);
+  }
+
+  block_at(0)->dominator = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (i32 i = 1; i < array_length(block_order); i++) {
+      Block *block = block_at(item_at(block_order, i));
+      i32 dominator = -1;
+      for (i32 j = 0; j < array_length(block->predecessors); j++) {
+        i32 predecessor = item_at(block->predecessors, j);
+        if (block_at(predecessor)->dominator < 0) continue;
+        dominator = dominator < 0 ? predecessor : intersect_dominators(predecessor, dominator);
+      }
+      if (block->dominator != dominator) {
+        block->dominator = dominator;
+        changed = true;
+      }
+    }
+  }
+
+  // Number the dominator tree depth first
+  for (i32 i = array_length(block_order) - 1; i > 0; i--) {
+    i32 id = item_at(block_order, i);
+    Block *dominator = block_at(block_at(id)->dominator);
+    block_at(id)->next_sibling = dominator->first_child;
+    dominator->first_child = id;
+  }
+  i32 number = 0;
+  stack_length = 1;
+  stack[0] = 0;
+  block_at(0)->search = block_at(0)->first_child;
+  block_at(0)->dominator_start = number++;
+  while (stack_length > 0) {
+    Block *block = block_at(stack[stack_length - 1]);
+    if (block->search >= 0) {
+      i32 child = block->search;
+      block->search = block_at(child)->next_sibling;
+      block_at(child)->search = block_at(child)->first_child;
+      block_at(child)->dominator_start = number++;
+      stack[stack_length] = child;
+      stack_length += 1;
+    } else {
+      block->dominator_end = number++;
+      stack_length -= 1;
+    }
+  }
+  free(stack);
+  free(postorder);
+}
+
+bool dominates(i32 a, i32 b) {
+  return block_at(a)->dominator_start <= block_at(b)->dominator_start && block_at(b)->dominator_end <= block_at(a)->dominator_end;
+}
+
+// Gives operations the value of an equal operation in a block that dominates theirs
+void eliminate_common_subexpressions() {
+  i64 bucket_count = 16;
+  while (bucket_count < 2 * (i64)array_length(function_values)) {
+    bucket_count *= 2;
+  }
+  i32 *buckets = malloc(bucket_count * sizeof(i32));
+  if (buckets == NULL) {
+    printf("Memory allocation failed in eliminate_common_subexpressions\n");
+    exit(1);
+  }
+  for (i64 i = 0; i < bucket_count; i++) {
+    buckets[i] = -1;
+  }
+  Array *available = array_create(arena, sizeof(Available));
+  for (i32 i = 0; i < array_length(block_order); i++) {
+    i32 block_id = item_at(block_order, i);
+    Block *block = block_at(block_id);
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      i32 id = item_at(block->code, j);
+      Value *value = value_at(id);
+      u8 code = value->code;
+      if (code != value_codes.add && code != value_codes.subtract && code != value_codes.multiply && code != value_codes.negate && (code != value_codes.divide || division_settings_used)) {
+        continue;
+      }
+      value->left = resolve_value(value->left);
+      value->right = resolve_value(value->right);
+      i32 left = value->left;
+      i32 right = value->right;
+      // Additions and multiplications give the same result with their operands swapped
+      if ((code == value_codes.add || code == value_codes.multiply) && left > right) {
+        left = value->right;
+        right = value->left;
+      }
+      u64 hash = ((u64)code * 0x9E3779B97F4A7C15u) ^ ((u64)(u32)left * 0xC2B2AE3D27D4EB4Fu) ^ ((u64)(u32)right * 0x165667B19E3779F9u);
+      i64 bucket = (i64)(hash >> 17) & (bucket_count - 1);
+      i32 entry_index = buckets[bucket];
+      while (entry_index >= 0) {
+        Available *entry = (Available *)array_get(available, entry_index);
+        if (entry->code == code && entry->left == left && entry->right == right && dominates(value_at(entry->value)->block, block_id)) {
+          value->replacement = entry->value;
+          break;
+        }
+        entry_index = entry->next;
+      }
+      if (entry_index < 0) {
+        Available entry = {.code = code, .left = left, .right = right, .value = id, .next = buckets[bucket]};
+        array_push(available, &entry);
+        buckets[bucket] = array_last(available);
+      }
+    }
+  }
+  free(buckets);
+}
+
+void mark_live(Array *worklist, i32 id) {
+  id = resolve_value(id);
+  if (id < 0 || value_at(id)->live) return;
+  value_at(id)->live = true;
+  array_push(worklist, &id);
+}
+
+// Keeps the instructions that have effects and the values they use, and resolves all operands to the values that are left
+void eliminate_dead_code() {
+  Array *worklist = array_create(arena, sizeof(i32));
+  for (i32 i = 0; i < array_length(function_values); i++) {
+    Value *value = value_at(i);
+    value->live = false;
+    if (value->code == value_codes.print || value->code == value_codes.precision || value->code == value_codes.rounding || value->code == value_codes.call) {
+      mark_live(worklist, i);
+    }
+  }
+  for (i32 i = 0; i < array_length(block_order); i++) {
+    Block *block = block_at(item_at(block_order, i));
+    if (block->end == block_ends.branch) {
+      block->left = resolve_value(block->left);
+      block->right = resolve_value(block->right);
+      mark_live(worklist, block->left);
+      mark_live(worklist, block->right);
+    }
+  }
+  for (i32 i = 0; exit_syncs != 0 && i < array_length(exit_syncs); i++) {
+    Sync *sync = (Sync *)array_get(exit_syncs, i);
+    sync->value = resolve_value(sync->value);
+    mark_live(worklist, sync->value);
+  }
+  while (array_length(worklist) > 0) {
+    Value *value = value_at(*(i32 *)array_pop(worklist));
+    value->left = resolve_value(value->left);
+    value->right = resolve_value(value->right);
+    mark_live(worklist, value->left);
+    mark_live(worklist, value->right);
+    for (i32 i = 0; value->operands != 0 && i < array_length(value->operands); i++) {
+      i32 operand = resolve_value(item_at(value->operands, i));
+      array_set(value->operands, i, &operand);
+      mark_live(worklist, operand);
+    }
+    for (i32 i = 0; value->syncs != 0 && i < array_length(value->syncs); i++) {
+      Sync *sync = (Sync *)array_get(value->syncs, i);
+      sync->value = resolve_value(sync->value);
+      mark_live(worklist, sync->value);
+    }
+  }
+}
+
+bool is_number(i32 id, i64 number) {
+  Value *value = value_at(id);
+  return value->code == value_codes.constant && number_compare(value->number, (Number){.value = number, .exponent = 0}) == 0;
+}
+
+// Adds an operation to the end of a block, or returns the operand it can't change like the optimizer does for `x * 1` and `x + 0`
+i32 insert_value(i32 block, u8 code, i32 left, i32 right) {
+  if (code == value_codes.multiply) {
+    if (is_number(left, 1) || is_number(right, 0)) return right;
+    if (is_number(right, 1) || is_number(left, 0)) return left;
+  } else if (code == value_codes.add && is_number(left, 0)) {
+    return right;
+  } else if (is_number(right, 0)) {
+    return left;
+  }
+  current_block = block;
+  i32 id = add_value(code, left, right);
+  value_at(id)->live = true;
+  return id;
+}
+
+// Returns the comparator that gives the same result with the compared values swapped
+u8 mirror_comparator(u8 comparator) {
+  if (comparator == comparators.less_than) {
+    return comparators.greater_than;
+  } else if (comparator == comparators.greater_than) {
+    return comparators.less_than;
+  } else if (comparator == comparators.less_than_or_equal_to) {
+    return comparators.greater_than_or_equal_to;
+  } else if (comparator == comparators.greater_than_or_equal_to) {
+    return comparators.less_than_or_equal_to;
+  }
+  return comparator;
+}
+
+// Returns true if a value is the same in every iteration of the marked loop
+bool is_loop_invariant(i32 id) {
+  Value *value = value_at(id);
+  return value->code == value_codes.constant || loop_marks[value->block] != loop_stamp;
+}
+
+// Counts how often each value that is left is used
+void count_uses(i32 *counts) {
+  memset(counts, 0, array_length(function_values) * sizeof(i32));
+  for (i32 i = 0; i < array_length(function_values); i++) {
+    Value *value = value_at(i);
+    if (!value->live || value->replacement != i) continue;
+    if (value->left >= 0) counts[resolve_value(value->left)] += 1;
+    if (value->right >= 0) counts[resolve_value(value->right)] += 1;
+    for (i32 j = 0; value->operands != 0 && j < array_length(value->operands); j++) {
+      counts[resolve_value(item_at(value->operands, j))] += 1;
+    }
+    for (i32 j = 0; value->syncs != 0 && j < array_length(value->syncs); j++) {
+      counts[resolve_value(((Sync *)array_get(value->syncs, j))->value)] += 1;
+    }
+  }
+  for (i32 i = 0; i < array_length(block_order); i++) {
+    Block *block = block_at(item_at(block_order, i));
+    if (block->end == block_ends.branch) {
+      counts[resolve_value(block->left)] += 1;
+      counts[resolve_value(block->right)] += 1;
+    }
+  }
+  for (i32 i = 0; exit_syncs != 0 && i < array_length(exit_syncs); i++) {
+    counts[resolve_value(((Sync *)array_get(exit_syncs, i))->value)] += 1;
+  }
+}
+
+// Finds the loop a block is the header of and marks its blocks, returns false if the block isn't the header of a loop without calls
+bool find_loop(i32 header_id, Loop *loop) {
+  Block *header = block_at(header_id);
+  if (array_length(header->predecessors) != 2) return false;
+  loop->header = header_id;
+  loop->latch_edge = -1;
+  for (i32 i = 0; i < 2; i++) {
+    i32 predecessor = item_at(header->predecessors, i);
+    if (block_at(predecessor)->order < 0) return false;
+    if (dominates(header_id, predecessor)) {
+      loop->latch_edge = i;
+    }
+  }
+  if (loop->latch_edge < 0) return false;
+  loop->latch = item_at(header->predecessors, loop->latch_edge);
+  loop->preheader = item_at(header->predecessors, 1 - loop->latch_edge);
+  if (block_at(loop->preheader)->successor_count != 1 || dominates(header_id, loop->preheader)) return false;
+  loop->counter.phi = -1;
+  loop->terms = 0;
+  loop->blocks = array_create(arena, sizeof(i32));
+  Array *blocks = loop->blocks;
+
+  // The blocks of the loop are the ones the latch can be reached from without passing the header
+  loop_stamp += 1;
+  loop_marks[header_id] = loop_stamp;
+  array_push(blocks, &header_id);
+  if (loop->latch != header_id) {
+    loop_marks[loop->latch] = loop_stamp;
+    array_push(blocks, &loop->latch);
+  }
+  for (i32 i = 0; i < array_length(blocks); i++) {
+    i32 block_id = item_at(blocks, i);
+    Block *block = block_at(block_id);
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      Value *value = value_at(item_at(block->code, j));
+      // Values computed for the loop would be live across the call
+      if (value->live && value->code == value_codes.call) return false;
+    }
+    for (i32 j = 0; block_id != header_id && j < array_length(block->predecessors); j++) {
+      i32 predecessor = item_at(block->predecessors, j);
+      if (block_at(predecessor)->order >= 0 && loop_marks[predecessor] != loop_stamp) {
+        loop_marks[predecessor] = loop_stamp;
+        array_push(blocks, &predecessor);
+      }
+    }
+  }
+  return true;
+}
+
+// Returns the induction variable a phi of the loop header is, with a phi of -1 if it isn't one
+Induction find_induction(Loop *loop, i32 phi) {
+  Induction induction = {.phi = -1};
+  Value *value = value_at(phi);
+  if (!value->live || value->code != value_codes.phi || value->replacement != phi) return induction;
+  Value *next = value_at(resolve_value(item_at(value->operands, loop->latch_edge)));
+  if (next->code == value_codes.add && next->left == phi && is_loop_invariant(next->right)) {
+    induction.step = next->right;
+  } else if (next->code == value_codes.add && next->right == phi && is_loop_invariant(next->left)) {
+    induction.step = next->left;
+  } else if (next->code == value_codes.subtract && next->left == phi && is_loop_invariant(next->right)) {
+    induction.step = next->right;
+  } else {
+    return induction;
+  }
+  induction.phi = phi;
+  induction.start = resolve_value(item_at(value->operands, 1 - loop->latch_edge));
+  induction.code = next->code;
+  return induction;
+}
+
+// Adds an induction variable to a loop, and returns its phi
+i32 add_induction(Loop *loop, i32 start, i32 step, u8 code, i32 variable) {
+  i32 phi = add_header_value(value_codes.phi, variable, loop->header);
+  Value *value = value_at(phi);
+  value->live = true;
+  i32 next = insert_value(loop->latch, code, phi, step);
+  value_at(next)->variable = variable;
+  value = value_at(phi);
+  for (i32 i = 0; i < 2; i++) {
+    i32 operand = i == loop->latch_edge ? next : start;
+    array_push(value->operands, &operand);
+  }
+  return phi;
+}
+
+// Returns 1 if a value is an operation on an induction variable on the left and a value that is the same in every iteration on the right, 2 if it's the other way around, and 0 otherwise
+u8 derived_side(Value *value, i32 phi) {
+  if (value->left < 0 || value->right < 0) return 0;
+  if (value->left == phi && value->right != phi && is_loop_invariant(value->right)) return 1;
+  if (value->right == phi && value->left != phi && is_loop_invariant(value->left)) return 2;
+  return 0;
+}
+
+// Replaces the operations of a kind on an induction variable and an invariant value by induction variables of their own
+void reduce_uses(Loop *loop, Induction *induction, u8 code, i32 next) {
+  for (i32 i = 0; i < array_length(loop->blocks); i++) {
+    Block *block = block_at(item_at(loop->blocks, i));
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      i32 id = item_at(block->code, j);
+      Value *value = value_at(id);
+      if (id == next || !value->live || value->replacement != id || value->code != code) continue;
+      u8 side = derived_side(value, induction->phi);
+      if (side == 0) continue;
+      i32 left = value->left;
+      i32 right = value->right;
+      i32 variable = value->variable;
+      i32 start = insert_value(loop->preheader, code, side == 1 ? induction->start : left, side == 1 ? right : induction->start);
+      i32 step = induction->step;
+      u8 step_code = induction->code;
+      if (code == value_codes.multiply) {
+        // (p + s) * k is p * k + s * k
+        step = insert_value(loop->preheader, value_codes.multiply, step, side == 1 ? right : left);
+      } else if (code == value_codes.subtract && side == 2) {
+        // k - (p + s) is (k - p) - s
+        step_code = step_code == value_codes.add ? value_codes.subtract : value_codes.add;
+      }
+      i32 reduced = add_induction(loop, start, step, step_code, variable);
+      value_at(id)->replacement = reduced;
+    }
+  }
+}
+
+// Finds the induction variable the condition of the loop compares to a value that is the same in every iteration
+void find_counter(Loop *loop) {
+  Block *header = block_at(loop->header);
+  loop->counter.phi = -1;
+  if (header->end != block_ends.branch || loop_marks[header->successors[0]] != loop_stamp || loop_marks[header->successors[1]] == loop_stamp) return;
+  for (i32 side = 0; side < 2; side++) {
+    i32 counter = side == 0 ? header->left : header->right;
+    i32 bound = side == 0 ? header->right : header->left;
+    if (value_at(counter)->block != loop->header || !is_loop_invariant(bound)) continue;
+    Induction induction = find_induction(loop, counter);
+    if (induction.phi < 0) continue;
+    loop->counter = induction;
+    loop->bound = bound;
+    loop->comparator = side == 0 ? header->comparator : mirror_comparator(header->comparator);
+    return;
+  }
+}
+
+// Returns true if the values of an induction variable derived from the counter fit in 64 bits in every iteration, which is only known when the counter moves towards its bound and all values involved are integer constants
+// Values that don't fit wrap around, and the condition on the derived variable could then end the loop in another iteration than the counter does
+bool derived_fits(Loop *loop, i32 derived) {
+  Value *value = value_at(derived);
+  u8 side = derived_side(value, loop->counter.phi);
+  i32 operands[4] = {loop->counter.start, loop->counter.step, loop->bound, side == 1 ? value->right : value->left};
+  i64 numbers[4];
+  for (i32 i = 0; i < 4; i++) {
+    Value *operand = value_at(resolve_value(operands[i]));
+    if (operand->code != value_codes.constant || operand->number.exponent != 0 || operand->number.value == INT64_MIN) return false;
+    numbers[i] = operand->number.value;
+  }
+  i64 start = numbers[0];
+  i64 step = loop->counter.code == value_codes.subtract ? -numbers[1] : numbers[1];
+  i64 bound = numbers[2];
+  i64 other = numbers[3];
+  u8 comparator = loop->comparator;
+  bool upwards = comparator == comparators.less_than || comparator == comparators.less_than_or_equal_to;
+  bool downwards = comparator == comparators.greater_than || comparator == comparators.greater_than_or_equal_to;
+  if (!(upwards && step > 0) && !(downwards && step < 0)) return false;
+  // The counter stays between its start and one step past its bound, and the derived variable follows it in one direction
+  i64 limits[2];
+  if (!add_fits(start < bound ? start : bound, step < 0 ? step : -step, &limits[0]) || !add_fits(start > bound ? start : bound, step < 0 ? -step : step, &limits[1])) {
+    return false;
+  }
+  for (i32 i = 0; i < 2; i++) {
+    i64 counter = limits[i];
+    i64 result;
+    bool fits = false;
+    if (value->code == value_codes.multiply) {
+      fits = multiply_fits(counter, other, &result);
+    } else if (value->code == value_codes.add) {
+      fits = add_fits(counter, other, &result);
+    } else if (side == 1) {
+      fits = add_fits(counter, -other, &result);
+    } else {
+      fits = counter != INT64_MIN && add_fits(other, -counter, &result);
+    }
+    if (!fits) return false;
+  }
+  return true;
+}
+
+// Makes the condition of a counted loop compare an induction variable derived from the counter instead, when nothing else needs the counter
+void replace_counter(Loop *loop) {
+  i32 counter = loop->counter.phi;
+  i32 next = resolve_value(item_at(value_at(counter)->operands, loop->latch_edge));
+  i32 *counts = malloc(array_length(function_values) * sizeof(i32));
+  if (counts == NULL) {
+    printf("Memory allocation failed in replace_counter\n");
+    exit(1);
+  }
+  count_uses(counts);
+  // The counter may only be used by its next value, the condition and sums that become induction variables
+  i32 sums = 0;
+  i32 derived = -1;
+  for (i32 i = 0; i < array_length(loop->blocks); i++) {
+    Block *block = block_at(item_at(loop->blocks, i));
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      i32 id = item_at(block->code, j);
+      Value *value = value_at(id);
+      if (id == next || !value->live || derived_side(value, counter) == 0) continue;
+      if (value->replacement == id && (value->code == value_codes.add || value->code == value_codes.subtract)) {
+        sums += 1;
+        derived = id;
+      } else if (value->replacement != id && value->code == value_codes.multiply && derived < 0) {
+        // Only a product with a constant other than zero orders its values like the counter, or the other way around
+        Value *factor = value_at(value->left == counter ? value->right : value->left);
+        if (factor->code == value_codes.constant && factor->number.value != 0) {
+          derived = id;
+        }
+      }
+    }
+  }
+  bool replaceable = derived >= 0 && counts[next] == 1 && counts[counter] == 2 + sums && derived_fits(loop, derived);
+  free(counts);
+  if (!replaceable) return;
+  reduce_uses(loop, &loop->counter, value_codes.add, next);
+  reduce_uses(loop, &loop->counter, value_codes.subtract, next);
+
+  // The bound goes through the same operation as the counter
+  Value *value = value_at(derived);
+  u8 side = derived_side(value, counter);
+  bool reverse = value->code == value_codes.subtract && side == 2;
+  if (value->code == value_codes.multiply) {
+    reverse = value_at(side == 1 ? value->right : value->left)->number.value < 0;
+  }
+  i32 bound = insert_value(loop->preheader, value->code, side == 1 ? loop->bound : value->left, side == 1 ? value->right : loop->bound);
+  Block *header = block_at(loop->header);
+  if (header->left == counter) {
+    header->left = value_at(derived)->replacement;
+    header->right = bound;
+  } else {
+    header->right = value_at(derived)->replacement;
+    header->left = bound;
+  }
+  if (reverse) {
+    header->comparator = mirror_comparator(header->comparator);
+  }
+  find_counter(loop);
+}
+
+// Finds the loops and their induction variables, turns products of induction variables into sums and records how many times counted loops run
+void reduce_induction_variables() {
+  function_loops = array_create(arena, sizeof(Loop));
+  i32 block_count = array_length(function_blocks);
+  loop_marks = (i32 *)arena_fill(arena, block_count * sizeof(i32));
+  memset(loop_marks, 0, block_count * sizeof(i32));
+  loop_stamp = 0;
+  // Inner loops come after outer ones in reverse postorder, so they are reduced first
+  for (i32 i = array_length(block_order) - 1; i >= 0; i--) {
+    Loop loop;
+    if (!find_loop(item_at(block_order, i), &loop)) continue;
+    i32 header_length = array_length(block_at(loop.header)->header);
+    for (i32 j = 0; j < header_length; j++) {
+      Induction induction = find_induction(&loop, item_at(block_at(loop.header)->header, j));
+      if (induction.phi >= 0) {
+        reduce_uses(&loop, &induction, value_codes.multiply, -1);
+      }
+    }
+    find_counter(&loop);
+    if (loop.counter.phi >= 0) {
+      replace_counter(&loop);
+    }
+    array_push(function_loops, &loop);
+  }
+}
+
+// Returns the induction variable of a phi, 0 if the phi isn't one
+Induction *find_in_inductions(Array *inductions, i32 phi) {
+  for (i32 i = 0; i < array_length(inductions); i++) {
+    Induction *induction = (Induction *)array_get(inductions, i);
+    if (induction->phi == phi) return induction;
+  }
+  return 0;
+}
+
+void add_term(Array *terms, i32 target, i32 source, bool triangular, bool negative) {
+  SeriesTerm term = {.target = target, .source = source, .triangular = triangular, .negative = negative};
+  array_push(terms, &term);
+}
+
+// Adds the terms of a phi that adds induction variables and invariant values to itself, returns false if the phi does anything else
+bool add_sum_terms(Loop *loop, Array *inductions, i32 phi, Array *terms) {
+  i32 id = resolve_value(item_at(value_at(phi)->operands, loop->latch_edge));
+  while (id != phi) {
+    Value *value = value_at(id);
+    if (value->code != value_codes.add && value->code != value_codes.subtract) return false;
+    i32 term = value->right;
+    i32 rest = value->left;
+    if (value->code == value_codes.add && !is_loop_invariant(term) && find_in_inductions(inductions, term) == 0) {
+      term = value->left;
+      rest = value->right;
+    }
+    bool negative = value->code == value_codes.subtract;
+    Induction *induction = find_in_inductions(inductions, term);
+    if (induction != 0) {
+      // An induction variable adds its start every iteration, and its step once in the second iteration, twice in the third and so on
+      add_term(terms, phi, term, false, negative);
+      add_term(terms, phi, induction->step, true, negative != (induction->code == value_codes.subtract));
+    } else if (is_loop_invariant(term)) {
+      add_term(terms, phi, term, false, negative);
+    } else {
+      return false;
+    }
+    id = rest;
+  }
+  return true;
+}
+
+// Finds the counted loops that only change induction variables and sums of them, whose values after the loop can be computed without running it
+void find_closed_forms() {
+  for (i32 l = 0; l < array_length(function_loops); l++) {
+    Loop *loop = (Loop *)array_get(function_loops, l);
+    if (loop->counter.phi < 0 || !value_at(loop->counter.phi)->live) continue;
+    loop_stamp += 1;
+    for (i32 i = 0; i < array_length(loop->blocks); i++) {
+      loop_marks[item_at(loop->blocks, i)] = loop_stamp;
+    }
+    // Nothing in the loop may have an effect, and it may not contain loops that could run forever
+    bool pure = true;
+    for (i32 i = 0; i < array_length(loop->blocks) && pure; i++) {
+      i32 block_id = item_at(loop->blocks, i);
+      Block *block = block_at(block_id);
+      for (i32 j = 0; j < array_length(block->code); j++) {
+        Value *value = value_at(item_at(block->code, j));
+        u8 code = value->code;
+        if (value->live && (code == value_codes.print || code == value_codes.precision || code == value_codes.rounding || code == value_codes.call)) {
+          pure = false;
+        }
+      }
+      for (i32 s = 0; s < block->successor_count; s++) {
+        i32 successor = block->successors[s];
+        if (successor != loop->header && loop_marks[successor] == loop_stamp && dominates(successor, block_id)) {
+          pure = false;
+        }
+      }
+    }
+    if (!pure) continue;
+
+    // Every phi that is used is an induction variable or a sum of them
+    Block *header = block_at(loop->header);
+    Array *inductions = array_create(arena, sizeof(Induction));
+    for (i32 i = 0; i < array_length(header->header); i++) {
+      Induction induction = find_induction(loop, item_at(header->header, i));
+      if (induction.phi >= 0) {
+        array_push(inductions, &induction);
+      }
+    }
+    Array *terms = array_create(arena, sizeof(SeriesTerm));
+    for (i32 i = 0; i < array_length(header->header) && pure; i++) {
+      i32 phi = item_at(header->header, i);
+      if (value_at(phi)->live && find_in_inductions(inductions, phi) == 0) {
+        pure = add_sum_terms(loop, inductions, phi, terms);
+      }
+    }
+    if (!pure) continue;
+    // The induction variables come last, as the sums read their values from before the loop
+    for (i32 i = 0; i < array_length(inductions); i++) {
+      Induction *induction = (Induction *)array_get(inductions, i);
+      add_term(terms, induction->phi, induction->step, false, induction->code == value_codes.subtract);
+    }
+    loop->terms = terms;
+    block_at(loop->preheader)->closed_form = l;
+  }
+}
+
+// Returns 1 if a value is a positive constant or a product of constants, -1 if it's a negative one, and 0 otherwise
+i32 constant_sign(i32 id) {
+  Value *value = value_at(resolve_value(id));
+  if (value->code == value_codes.constant) {
+    return value->number.value > 0 ? 1 : value->number.value < 0 ? -1 : 0;
+  } else if (value->code == value_codes.multiply) {
+    return constant_sign(value->left) * constant_sign(value->right);
+  }
+  return 0;
+}
+
+// Returns the copy a value has in one iteration of an unrolled loop, or the value itself if it's from outside the loop
+i32 copied_value(i32 *copies, i32 copied_count, i32 id) {
+  id = resolve_value(id);
+  return id >= 0 && id < copied_count && copies[id] >= 0 ? copies[id] : id;
+}
+
+// Adds a value with the code and settings of another one to a block, without its operands
+i32 copy_value(i32 id, i32 block, bool header) {
+  i32 copy = new_value(value_at(id)->code, block);
+  Value *value = value_at(id);
+  Value *copied = value_at(copy);
+  copied->live = true;
+  copied->variable = value->variable;
+  copied->setting = value->setting;
+  copied->number = value->number;
+  if (value->code == value_codes.phi) {
+    copied->operands = array_create(arena, sizeof(i32));
+  }
+  array_push(header ? block_at(block)->header : block_at(block)->code, &copy);
+  return copy;
+}
+
+// Gives the copies of the values in a list of the loop the copies of their operands
+void copy_operands(Array *list, i32 *copies, i32 copied_count) {
+  for (i32 i = 0; i < array_length(list); i++) {
+    i32 id = item_at(list, i);
+    Value *value = value_at(id);
+    if (!value->live) continue;
+    Value *copied = value_at(copies[id]);
+    copied->left = value->left < 0 ? -1 : copied_value(copies, copied_count, value->left);
+    copied->right = value->right < 0 ? -1 : copied_value(copies, copied_count, value->right);
+    for (i32 j = 0; value->operands != 0 && j < array_length(value->operands); j++) {
+      i32 operand = copied_value(copies, copied_count, item_at(value->operands, j));
+      array_push(copied->operands, &operand);
+    }
+  }
+}
+
+// Repeats the body of a small counted loop so that its condition is tested once every UNROLL_FACTOR iterations, returns false if the loop is left as it is
+// The repeated loop runs while the counter would still meet the condition in the last of its iterations, and the loop itself runs the iterations that remain after it
+bool unroll_loop(Loop *loop, i32 block_count) {
+  Block *header = block_at(loop->header);
+  if (loop->terms != 0 || loop->counter.phi < 0 || !value_at(loop->counter.phi)->live) return false;
+  if (loop->latch == loop->header || header->reloads || block_at(loop->latch)->end != block_ends.jump) return false;
+  // The counter has to move towards the bound, then the condition holds in every iteration before one it holds in
+  i32 direction = constant_sign(loop->counter.step) * (loop->counter.code == value_codes.subtract ? -1 : 1);
+  u8 comparator = loop->comparator;
+  bool upwards = comparator == comparators.less_than || comparator == comparators.less_than_or_equal_to;
+  bool downwards = comparator == comparators.greater_than || comparator == comparators.greater_than_or_equal_to;
+  if (!(upwards && direction > 0) && !(downwards && direction < 0)) return false;
+
+  // Only loops without inner loops whose body is only left through the header are small enough
+  loop_stamp += 1;
+  for (i32 i = 0; i < array_length(loop->blocks); i++) {
+    loop_marks[item_at(loop->blocks, i)] = loop_stamp;
+  }
+  i32 size = 0;
+  for (i32 i = 0; i < array_length(loop->blocks); i++) {
+    i32 block_id = item_at(loop->blocks, i);
+    Block *block = block_at(block_id);
+    if (block->reloads) return false;
+    for (i32 s = 0; block_id != loop->header && s < block->successor_count; s++) {
+      i32 successor = block->successors[s];
+      if (successor >= block_count || loop_marks[successor] != loop_stamp) return false;
+      if (successor == loop->header ? block_id != loop->latch : dominates(successor, block_id)) return false;
+    }
+    for (i32 j = 0; j < array_length(block->header); j++) {
+      size += value_at(item_at(block->header, j))->live;
+    }
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      size += value_at(item_at(block->code, j))->live;
+    }
+  }
+  if (size > MAX_UNROLL_VALUES) return false;
+
+  // The values of an iteration are those of the header after its phis and those of the body blocks, in their layout order
+  Array *body = array_create(arena, sizeof(i32));
+  for (i32 i = 0; i < array_length(block_layout); i++) {
+    i32 block_id = item_at(block_layout, i);
+    if (block_id < block_count && block_id != loop->header && loop_marks[block_id] == loop_stamp) {
+      array_push(body, &block_id);
+    }
+  }
+  i32 value_count = array_length(function_values);
+  i32 *copies = malloc((i64)UNROLL_FACTOR * value_count * sizeof(i32));
+  i32 *block_copies = malloc((i64)UNROLL_FACTOR * block_count * sizeof(i32));
+  i32 *entries = malloc(UNROLL_FACTOR * sizeof(i32));
+  if (copies == NULL || block_copies == NULL || entries == NULL) {
+    printf("Memory allocation failed in unroll_loop\n");
+    exit(1);
+  }
+  memset(copies, -1, (i64)UNROLL_FACTOR * value_count * sizeof(i32));
+  i32 test = new_block();
+  for (i32 k = 0; k < UNROLL_FACTOR; k++) {
+    entries[k] = new_block();
+    for (i32 i = 0; i < array_length(body); i++) {
+      block_copies[k * block_count + item_at(body, i)] = new_block();
+    }
+  }
+
+  // The repeated loop tests a bound that is as many steps closer as it has iterations after the first
+  i32 bound = loop->bound;
+  for (i32 k = 1; k < UNROLL_FACTOR; k++) {
+    bound = insert_value(loop->preheader, loop->counter.code == value_codes.add ? value_codes.subtract : value_codes.add, bound, loop->counter.step);
+  }
+  Array *phis = header->header;
+  for (i32 i = 0; i < array_length(phis); i++) {
+    i32 phi = item_at(phis, i);
+    if (value_at(phi)->live) {
+      copies[phi] = copy_value(phi, test, true);
+    }
+  }
+  for (i32 k = 0; k < UNROLL_FACTOR; k++) {
+    i32 *copy = copies + (i64)k * value_count;
+    i32 *block_copy = block_copies + (i64)k * block_count;
+    // The phis of the header are the values of the previous iteration at the end of its body
+    for (i32 i = 0; k > 0 && i < array_length(phis); i++) {
+      i32 phi = item_at(phis, i);
+      if (value_at(phi)->live) {
+        copy[phi] = copied_value(copy - value_count, value_count, item_at(value_at(phi)->operands, loop->latch_edge));
+      }
+    }
+    for (i32 i = 0; i < array_length(header->code); i++) {
+      i32 id = item_at(header->code, i);
+      if (value_at(id)->live) {
+        copy[id] = copy_value(id, entries[k], false);
+      }
+    }
+    for (i32 i = 0; i < array_length(body); i++) {
+      Block *block = block_at(item_at(body, i));
+      i32 copied_block = block_copy[item_at(body, i)];
+      for (i32 j = 0; j < array_length(block->header); j++) {
+        i32 id = item_at(block->header, j);
+        if (value_at(id)->live) {
+          copy[id] = copy_value(id, copied_block, true);
+        }
+      }
+      for (i32 j = 0; j < array_length(block->code); j++) {
+        i32 id = item_at(block->code, j);
+        if (value_at(id)->live) {
+          copy[id] = copy_value(id, copied_block, false);
+        }
+      }
+    }
+    copy_operands(header->code, copy, value_count);
+    for (i32 i = 0; i < array_length(body); i++) {
+      Block *block = block_at(item_at(body, i));
+      copy_operands(block->header, copy, value_count);
+      copy_operands(block->code, copy, value_count);
+    }
+
+    // The blocks of an iteration start with the header and continue at the next iteration instead of going back to it
+    Block *entry = block_at(entries[k]);
+    entry->sealed = true;
+    entry->end = block_ends.jump;
+    entry->successors[0] = block_copy[header->successors[0]];
+    entry->successor_count = 1;
+    i32 predecessor = k == 0 ? test : block_copies[(k - 1) * block_count + loop->latch];
+    array_push(entry->predecessors, &predecessor);
+    for (i32 i = 0; i < array_length(body); i++) {
+      Block *block = block_at(item_at(body, i));
+      Block *copied_block = block_at(block_copy[item_at(body, i)]);
+      copied_block->sealed = true;
+      copied_block->end = block->end;
+      copied_block->comparator = block->comparator;
+      if (block->end == block_ends.branch) {
+        copied_block->left = copied_value(copy, value_count, block->left);
+        copied_block->right = copied_value(copy, value_count, block->right);
+      }
+      copied_block->successor_count = block->successor_count;
+      for (i32 s = 0; s < block->successor_count; s++) {
+        i32 successor = block->successors[s];
+        if (successor == loop->header) {
+          copied_block->successors[s] = k + 1 < UNROLL_FACTOR ? entries[k + 1] : test;
+        } else {
+          copied_block->successors[s] = block_copy[successor];
+        }
+      }
+      for (i32 j = 0; j < array_length(block->predecessors); j++) {
+        i32 predecessor = item_at(block->predecessors, j);
+        predecessor = predecessor == loop->header ? entries[k] : block_copy[predecessor];
+        array_push(copied_block->predecessors, &predecessor);
+      }
+    }
+  }
+
+  // The repeated loop is entered from the preheader and continues with the loop itself, which gets its values from it
+  i32 *last = copies + (i64)(UNROLL_FACTOR - 1) * value_count;
+  Block *test_block = block_at(test);
+  test_block->sealed = true;
+  test_block->end = block_ends.branch;
+  test_block->comparator = comparator;
+  test_block->left = copies[loop->counter.phi];
+  test_block->right = bound;
+  test_block->successors[0] = entries[0];
+  test_block->successors[1] = loop->header;
+  test_block->successor_count = 2;
+  for (i32 edge = 0; edge < 2; edge++) {
+    i32 predecessor = edge == loop->latch_edge ? block_copies[(UNROLL_FACTOR - 1) * block_count + loop->latch] : loop->preheader;
+    array_push(test_block->predecessors, &predecessor);
+  }
+  for (i32 i = 0; i < array_length(phis); i++) {
+    i32 phi = item_at(phis, i);
+    Value *value = value_at(phi);
+    if (!value->live) continue;
+    for (i32 edge = 0; edge < 2; edge++) {
+      i32 operand = resolve_value(item_at(value->operands, edge));
+      if (edge == loop->latch_edge) {
+        operand = copied_value(last, value_count, operand);
+      }
+      array_push(value_at(copies[phi])->operands, &operand);
+    }
+    array_set(value->operands, 1 - loop->latch_edge, &copies[phi]);
+  }
+  array_set(header->predecessors, 1 - loop->latch_edge, &test);
+  block_at(loop->preheader)->successors[0] = test;
+
+  // The repeated iterations are laid out before the loop, with their test at the bottom like the loop has
+  Array *layout = array_create(arena, sizeof(i32));
+  bool placed = false;
+  for (i32 i = 0; i < array_length(block_layout); i++) {
+    i32 block_id = item_at(block_layout, i);
+    if (!placed && block_id < block_count && loop_marks[block_id] == loop_stamp) {
+      for (i32 k = 0; k < UNROLL_FACTOR; k++) {
+        array_push(layout, &entries[k]);
+        for (i32 j = 0; j < array_length(body); j++) {
+          array_push(layout, &block_copies[k * block_count + item_at(body, j)]);
+        }
+      }
+      array_push(layout, &test);
+      placed = true;
+    }
+    array_push(layout, &block_id);
+  }
+  block_layout = layout;
+  free(copies);
+  free(block_copies);
+  free(entries);
+  return true;
+}
+
+// Unrolls the small counted loops that don't have a closed form, and finds the blocks and values that are left again when it did
+void unroll_loops() {
+  if (UNROLL_FACTOR < 2) return;
+  i32 block_count = array_length(function_blocks);
+  bool unrolled = false;
+  for (i32 l = 0; l < array_length(function_loops); l++) {
+    if (unroll_loop((Loop *)array_get(function_loops, l), block_count)) {
+      unrolled = true;
+    }
+  }
+  if (unrolled) {
+    order_blocks();
+    eliminate_dead_code();
+  }
+}
+
+void use_value(Block *block, i32 id) {
+  if (is_tracked(id) && !set_has(block->defines, id)) {
+    set_add(block->uses, id);
+  }
+}
+
+// Finds the values that are live at the start and end of every block
+void compute_liveness() {
+  set_words = (array_length(function_values) + 63) / 64;
+  for (i32 i = 0; i < array_length(block_order); i++) {
+    Block *block = block_at(item_at(block_order, i));
+    block->uses = new_set();
+    block->defines = new_set();
+    block->live_in = new_set();
+    block->live_out = new_set();
+    for (i32 j = 0; j < array_length(block->header); j++) {
+      set_add(block->defines, item_at(block->header, j));
+    }
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      i32 id = item_at(block->code, j);
+      Value *value = value_at(id);
+      if (!value->live) continue;
+      use_value(block, value->left);
+      use_value(block, value->right);
+      for (i32 k = 0; value->syncs != 0 && k < array_length(value->syncs); k++) {
+        use_value(block, ((Sync *)array_get(value->syncs, k))->value);
+      }
+      set_add(block->defines, id);
+    }
+    if (block->end == block_ends.branch) {
+      use_value(block, block->left);
+      use_value(block, block->right);
+    } else if (block->end == block_ends.exit) {
+      for (i32 k = 0; exit_syncs != 0 && k < array_length(exit_syncs); k++) {
+        use_value(block, ((Sync *)array_get(exit_syncs, k))->value);
+      }
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (i32 i = array_length(block_order) - 1; i >= 0; i--) {
+      i32 block_id = item_at(block_order, i);
+      Block *block = block_at(block_id);
+      for (i32 s = 0; s < block->successor_count; s++) {
+        Block *successor = block_at(block->successors[s]);
+        for (i32 w = 0; w < set_words; w++) {
+          block->live_out[w] |= successor->live_in[w];
+        }
+        // A phi uses its operand at the end of the predecessor it comes from
+        i32 edge = 0;
+        while (item_at(successor->predecessors, edge) != block_id) {
+          edge += 1;
+        }
+        for (i32 j = 0; j < array_length(successor->header); j++) {
+          Value *phi = value_at(item_at(successor->header, j));
+          if (phi->live && phi->code == value_codes.phi && is_tracked(item_at(phi->operands, edge))) {
+            set_add(block->live_out, item_at(phi->operands, edge));
+          }
+        }
+      }
+      for (i32 w = 0; w < set_words; w++) {
+        u64 live_in = block->uses[w] | (block->live_out[w] & ~block->defines[w]);
+        if (live_in != block->live_in[w]) {
+          block->live_in[w] = live_in;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+// Returns the register of the variable the value prefers if it's free, and the lowest free temporary otherwise
+i32 choose_register(Value *value) {
+  if (value->variable >= 0 && occupied[value->variable] != occupation_stamp) {
+    return value->variable;
+  }
+  i32 reg = temporary_start + 1;
+  while (occupied[reg] == occupation_stamp) {
+    reg += 1;
+  }
+  if (reg - temporary_start + 1 > temporary_count) {
+    temporary_count = reg - temporary_start + 1;
+  }
+  return reg;
+}
+
+// Gives every live value a register that no other value uses while it's live
+void allocate_registers() {
+  compute_liveness();
+  i32 register_limit = temporary_start + array_length(function_values) + 2;
+  occupied = malloc(register_limit * sizeof(i32));
+  if (occupied == NULL) {
+    printf("Memory allocation failed in allocate_registers\n");
+    exit(1);
+  }
+  memset(occupied, 0, register_limit * sizeof(i32));
+  u64 *live = new_set();
+  for (i32 i = 0; i < array_length(block_order); i++) {
+    Block *block = block_at(item_at(block_order, i));
+    // Walk back from the end of the block to find the last use of each value
+    memcpy(live, block->live_out, set_words * sizeof(u64));
+    if (block->end == block_ends.branch) {
+      if (is_tracked(block->left)) set_add(live, block->left);
+      if (is_tracked(block->right)) set_add(live, block->right);
+    } else if (block->end == block_ends.exit) {
+      for (i32 k = 0; exit_syncs != 0 && k < array_length(exit_syncs); k++) {
+        i32 id = ((Sync *)array_get(exit_syncs, k))->value;
+        if (is_tracked(id)) set_add(live, id);
+      }
+    }
+    for (i32 j = array_length(block->code) - 1; j >= 0; j--) {
+      i32 id = item_at(block->code, j);
+      Value *value = value_at(id);
+      if (!value->live) continue;
+      set_remove(live, id);
+      value->dying = 0;
+      if (value->code == value_codes.call) {
+        for (i32 w = 0; w < set_words; w++) {
+          if (live[w] != 0) compile_fail();
+        }
+        for (i32 k = 0; k < array_length(value->syncs); k++) {
+          i32 sync = ((Sync *)array_get(value->syncs, k))->value;
+          if (is_tracked(sync)) set_add(live, sync);
+        }
+        continue;
+      }
+      if (is_tracked(value->left) && !set_has(live, value->left)) {
+        value->dying |= 1;
+        set_add(live, value->left);
+      }
+      if (is_tracked(value->right) && !set_has(live, value->right)) {
+        value->dying |= 2;
+        set_add(live, value->right);
+      }
+    }
+
+    // Walk forward giving each value a register that is free where it's defined
+    occupation_stamp += 1;
+    for (i32 w = 0; w < set_words; w++) {
+      for (i32 bit = 0; bit < 64; bit++) {
+        if ((block->live_in[w] >> bit) & 1) {
+          occupied[value_at(w * 64 + bit)->reg] = occupation_stamp;
+        }
+      }
+    }
+    for (i32 j = 0; j < array_length(block->header); j++) {
+      Value *value = value_at(item_at(block->header, j));
+      if (!value->live) continue;
+      value->reg = choose_register(value);
+      occupied[value->reg] = occupation_stamp;
+    }
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      Value *value = value_at(item_at(block->code, j));
+      if (!value->live) continue;
+      u8 code = value->code;
+      if (code == value_codes.call) {
+        // Nothing is live after a call
+        occupation_stamp += 1;
+        continue;
+      }
+      if (value->dying & 1) occupied[value_at(value->left)->reg] = 0;
+      if (value->dying & 2) occupied[value_at(value->right)->reg] = 0;
+      if (code != value_codes.print && code != value_codes.precision && code != value_codes.rounding) {
+        value->reg = choose_register(value);
+        occupied[value->reg] = occupation_stamp;
+      }
+    }
+  }
+  free(occupied);
+}
+
+// Turns the phis into moves at the end of their predecessors, adding a block on edges from a block that branches
+void place_phi_moves() {
+  i32 block_count = array_length(function_blocks);
+  for (i32 b = 0; b < block_count; b++) {
+    Block *block = block_at(b);
+    if (block->order < 0) continue;
+    for (i32 edge = 0; edge < array_length(block->predecessors); edge++) {
+      Array *copies = array_create(arena, sizeof(Copy));
+      for (i32 j = 0; j < array_length(block->header); j++) {
+        Value *phi = value_at(item_at(block->header, j));
+        if (!phi->live || phi->code != value_codes.phi) continue;
+        Copy copy = {.destination = phi->reg, .source = value_at(item_at(phi->operands, edge))->reg};
+        if (copy.destination != copy.source) {
+          array_push(copies, &copy);
+        }
+      }
+      if (array_length(copies) == 0) continue;
+      i32 predecessor_id = item_at(block->predecessors, edge);
+      Block *predecessor = block_at(predecessor_id);
+      if (predecessor->successor_count == 1) {
+        for (i32 j = 0; j < array_length(copies); j++) {
+          array_push(predecessor->copies, array_get(copies, j));
+        }
+        continue;
+      }
+      i32 edge_block_id = new_block();
+      Block *edge_block = block_at(edge_block_id);
+      predecessor = block_at(predecessor_id);
+      edge_block->copies = copies;
+      edge_block->end = block_ends.jump;
+      edge_block->successors[0] = b;
+      edge_block->successor_count = 1;
+      edge_block->order = 0;
+      for (i32 s = 0; s < predecessor->successor_count; s++) {
+        if (predecessor->successors[s] == b) {
+          predecessor->successors[s] = edge_block_id;
+        }
+      }
+      array_push(block_layout, &edge_block_id);
+    }
+  }
+}
+
+// Generates moves that all read their source before any of them writes, using the first temporary register to break cycles
+void emit_copies(Array *copy_list) {
+  i32 count = array_length(copy_list);
+  if (count == 0) return;
+  Copy *copies = (Copy *)arena_fill(arena, count * sizeof(Copy));
+  for (i32 i = 0; i < count; i++) {
+    copies[i] = *(Copy *)array_get(copy_list, i);
+  }
+  while (count > 0) {
+    bool moved = false;
+    for (i32 i = 0; i < count && !moved; i++) {
+      bool read_later = false;
+      for (i32 j = 0; j < count; j++) {
+        read_later |= j != i && copies[j].source == copies[i].destination;
+      }
+      if (!read_later) {
+        emit(op_move, copies[i].destination, copies[i].source, 0);
+        copies[i] = copies[count - 1];
+        count -= 1;
+        moved = true;
+      }
+    }
+    if (!moved) {
+      // Every destination is still to be read, so one of them is saved first
+      i32 saved = copies[0].destination;
+      emit(op_move, temporary_start, saved, 0);
+      for (i32 j = 0; j < count; j++) {
+        if (copies[j].source == saved) {
+          copies[j].source = temporary_start;
+        }
+      }
+    }
+  }
+}
+
+// Generates the moves that put the values of variables in their registers
+void emit_syncs(Array *syncs) {
+  Array *copies = array_create(arena, sizeof(Copy));
+  for (i32 i = 0; i < array_length(syncs); i++) {
+    Sync *sync = (Sync *)array_get(syncs, i);
+    Copy copy = {.destination = sync->variable, .source = value_at(sync->value)->reg};
+    if (copy.destination != copy.source) {
+      array_push(copies, &copy);
+    }
+  }
+  emit_copies(copies);
+}
+
+// Returns the jump taken when a comparison holds, or when it doesn't if negate is true
+u8 branch_code(u8 comparator, bool negate) {
+  if (comparator == comparators.less_than) {
+    return negate ? op_jump_if_greater_equal : op_jump_if_less;
+  } else if (comparator == comparators.greater_than) {
+    return negate ? op_jump_if_less_equal : op_jump_if_greater;
+  } else if (comparator == comparators.less_than_or_equal_to) {
+    return negate ? op_jump_if_greater : op_jump_if_less_equal;
+  } else if (comparator == comparators.greater_than_or_equal_to) {
+    return negate ? op_jump_if_less : op_jump_if_greater_equal;
+  }
+  return negate ? op_jump_if_not_equal : op_jump_if_equal;
+}
+
+void emit_jump(Array *fixups, u8 code, i32 left, i32 right, i32 target) {
+  Fixup fixup = {.instruction = emit(code, 0, left, right), .block = target};
+  array_push(fixups, &fixup);
+}
+
+// Generates the instructions of a value
+void emit_value(Value *value) {
+  u8 code = value->code;
+  if (code == value_codes.print) {
+    emit(op_print, 0, value_at(value->left)->reg, 0);
+  } else if (code == value_codes.precision) {
+    emit(op_precision, 0, value->setting, 0);
+  } else if (code == value_codes.rounding) {
+    emit(op_rounding, 0, value->setting, 0);
+  } else if (code == value_codes.call) {
+    emit_syncs(value->syncs);
+    // The instance id is replaced by its entry once all instances are generated
+    emit(op_call, value->instance->id, 0, 0);
+  } else if (code == value_codes.negate) {
+    emit(op_negate, value->reg, value_at(value->left)->reg, 0);
+  } else {
+    Value *left = value_at(value->left);
+    Value *right = value_at(value->right);
+    // Adding or subtracting a small integer constant is one op_increment
+    if ((code == value_codes.add || code == value_codes.subtract) && right->code == value_codes.constant) {
+      Number step = right->number;
+      if (step.exponent == 0 && step.value > -2147483647 && step.value < 2147483647) {
+        emit(op_increment, value->reg, left->reg, code == value_codes.add ? (i32)step.value : -(i32)step.value);
+        return;
+      }
+    }
+    u8 op_code = op_add;
+    if (code == value_codes.subtract) {
+      op_code = op_subtract;
+    } else if (code == value_codes.multiply) {
+      op_code = op_multiply;
+    } else if (code == value_codes.divide) {
+      op_code = op_divide;
+    }
+    emit(op_code, value->reg, left->reg, right->reg);
+  }
+}
+
+// Generates the instruction that computes the values of a loop after it, for a loop that has a closed form
+void emit_series(Loop *loop) {
+  Series entry = {
+    .counter = value_at(loop->counter.phi)->reg,
+    .step = value_at(resolve_value(loop->counter.step))->reg,
+    .decreasing = loop->counter.code == value_codes.subtract,
+    .bound = value_at(resolve_value(loop->bound))->reg,
+    .comparator = loop->comparator,
+    .first_term = array_length(series_terms),
+    .term_count = array_length(loop->terms)
+  };
+  for (i32 i = 0; i < array_length(loop->terms); i++) {
+    SeriesTerm term = *(SeriesTerm *)array_get(loop->terms, i);
+    term.target = value_at(term.target)->reg;
+    term.source = value_at(resolve_value(term.source))->reg;
+    array_push(series_terms, &term);
+  }
+  array_push(series, &entry);
+  emit(op_series, array_last(series), 0, 0);
+}
+
+// Generates the blocks in their layout order, leaving out jumps to the block that comes next
+void emit_blocks(Instance *instance) {
+  Array *fixups = array_create(arena, sizeof(Fixup));
+  i32 layout_length = array_length(block_layout);
+  for (i32 i = 0; i < layout_length; i++) {
+    Block *block = block_at(item_at(block_layout, i));
+    block->address = array_length(instructions);
+    if (block->order < 0) continue;
+    for (i32 j = 0; j < array_length(block->header); j++) {
+      Value *value = value_at(item_at(block->header, j));
+      if (value->live && value->code == value_codes.load && value->reg != value->variable) {
+        emit(op_move, value->reg, value->variable, 0);
+      }
+    }
+    for (i32 j = 0; j < array_length(block->code); j++) {
+      Value *value = value_at(item_at(block->code, j));
+      if (value->live) {
+        emit_value(value);
+      }
+    }
+    emit_copies(block->copies);
+    if (block->closed_form >= 0) {
+      emit_series((Loop *)array_get(function_loops, block->closed_form));
+    }
+    i32 next = i + 1 < layout_length ? item_at(block_layout, i + 1) : -1;
+    if (block->end == block_ends.jump) {
+      if (block->successors[0] != next) {
+        emit_jump(fixups, op_jump, 0, 0, block->successors[0]);
+      }
+    } else if (block->end == block_ends.branch) {
+      i32 left = value_at(block->left)->reg;
+      i32 right = value_at(block->right)->reg;
+      if (block->successors[1] == next) {
+        emit_jump(fixups, branch_code(block->comparator, false), left, right, block->successors[0]);
+      } else if (block->successors[0] == next) {
+        emit_jump(fixups, branch_code(block->comparator, true), left, right, block->successors[1]);
+      } else {
+        emit_jump(fixups, branch_code(block->comparator, false), left, right, block->successors[0]);
+        emit_jump(fixups, op_jump, 0, 0, block->successors[1]);
+      }
+    } else if (instance != 0) {
+      emit_syncs(exit_syncs);
+      emit(op_return, 0, 0, 0);
+    } else {
+      if (exit_syncs != 0) {
+        emit_syncs(exit_syncs);
+      }
+      emit(op_halt, 0, 0, 0);
+    }
+  }
+  for (i32 i = 0; i < array_length(fixups); i++) {
+    Fixup *fixup = (Fixup *)array_get(fixups, i);
+    ((Instruction *)array_get(instructions, fixup->instruction))->a = block_at(fixup->block)->address;
+  }
+}
+
+// generate_function: translates the statements of the program or of a snippet instance into instructions
+void generate_function(Statement *body, Instance *instance) {
+  function_values = array_create(arena, sizeof(Value));
+  function_blocks = array_create(arena, sizeof(Block));
+  block_layout = array_create(arena, sizeof(i32));
+  written_added = array_create(arena, sizeof(i32));
+  exit_syncs = 0;
+  constant_values = (i32 *)arena_fill(arena, (temporary_start + 1) * sizeof(i32));
+  for (i32 i = 0; i <= temporary_start; i++) {
+    constant_values[i] = -1;
+  }
+  definition_size = 0;
+  definition_count = 0;
+  definition_keys = 0;
+  definition_values = 0;
+  resize_definitions(1024);
+
+  i32 entry = new_block();
+  block_at(entry)->reloads = true;
+  block_at(entry)->sealed = true;
+  start_block(entry);
+  build_statements(body);
+  if (instance != 0) {
+    exit_syncs = collect_syncs(instance->scope, false);
+  } else if (region_scope != 0) {
+    exit_syncs = collect_syncs(region_scope, false);
+  }
+  block_at(current_block)->end = block_ends.exit;
+  free(definition_keys);
+  free(definition_values);
+
+  remove_trivial_phis();
+  order_blocks();
+  eliminate_common_subexpressions();
+  remove_trivial_phis();
+  eliminate_dead_code();
+  reduce_induction_variables();
+  eliminate_dead_code();
+  find_closed_forms();
+  unroll_loops();
+  allocate_registers();
+  if (parse_failed) return;
+  place_phi_moves();
+  if (instance != 0) {
+    instance->entry = array_length(instructions);
+  }
+  emit_blocks(instance);
+}
+
+#define TARZAN_IR
+#endif
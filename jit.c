@@ -0,0 +1,700 @@
+#ifndef TARZAN_JIT
+
+/*
+
+Native code for the hot loops of the register machine on x86-64 Linux, with the following functions:
+- jit_create: sets up the loop counters for a program
+- jit_run_loop: counts an iteration of a loop, and runs the loop as native code once it's hot
+- jit_free: unmaps the native code
+
+The machine counts how often every jump back to an earlier instruction is taken. After JIT_HOT_LOOP of them, the loop from the target of the jump up to the jump itself is translated to x86-64 instructions. These are written to pages from mmap that are made executable once the code is in them, so no page is writable and executable at the same time. The native code only moves, adds, subtracts, multiplies, negates, compares and jumps, so loops that divide, print or compute a series stay in the machine.
+
+A loop whose instructions are all of those kinds is translated as a whole, with its branches and inner loops. A loop that calls snippets is traced instead: the next iteration runs in a recorder that does what the machine does and writes down every instruction it runs, following calls and returns and the branches the way they went. The trace is one straight run of instructions back to the top of the loop. Calls and jumps disappear from it, and every branch becomes a guard that leaves the native code when the branch goes the other way than it did while recording. Such a side exit continues in the machine at the instruction the branch goes to, and when it is inside a snippet the machine first gets the return addresses of the calls it is in. A side exit that is taken JIT_HOT_EXIT times gets a path of its own: the recorder runs the rest of that iteration from the guard, and the loop is translated again with the guard jumping to the new path instead of leaving, so a branch that goes both ways stays in native code. A trace has at most JIT_MAX_PATHS paths. A path ends at the jump that closes the loop, so an iteration that runs an inner loop or one that is longer than JIT_MAX_TRACE instructions can't be traced, and the loop stays in the machine.
+
+The native code keeps the registers the loop uses most in processor registers, and the others in the register array. It only works on integers. When it starts, it checks that every register the loop uses has exponent 0, and otherwise returns right away so that the machine runs the loop instead. Integer arithmetic only gives integers, so no decimal can appear while the loop runs and the values need no further checks. Like in the machine, integers wrap around when they don't fit in 64 bits. When the loop exits, the registers it changed get their values back. A loop that keeps finding decimals is left to the machine after JIT_MAX_BAILS tries.
+
+*/
+
+#ifdef VM_JIT
+
+#include <stddef.h> // offsetof
+#include <sys/mman.h> // mmap, mprotect, munmap
+
+// Native code of a loop, which returns the number of the exit it took, or -1 when it found a decimal
+typedef i32 (*NativeLoop)(Number *registers);
+
+// Place in the machine that native code continues at when it takes an exit
+typedef struct {
+  i32 resume; // Instruction the machine continues at
+  i32 first_frame; // Return addresses the machine pushes on its call stack first, for an exit inside a called snippet
+  i32 frame_count;
+  i32 path; // Path of the trace whose guard the exit is for, -1 for an exit that isn't a side exit
+  i32 step; // Step of the guard in its path
+  u32 count; // Times the exit was taken
+} NativeExit;
+
+typedef struct {
+  NativeLoop code; // 0 until the loop is translated
+  NativeExit *exits;
+  i32 *frames;
+  Array *paths; // Paths of the trace the code was translated from, 0 for a loop that was translated as a whole
+} NativeCode;
+
+// Pages from mmap that hold native code
+typedef struct {
+  void *address;
+  i64 size;
+} CodePages;
+
+typedef struct Jit {
+  Program *program;
+  u32 *heat; // Times the jump at each instruction went back, JIT_OFF when its loop stays in the machine
+  u32 *tries; // Times the loop that ends at each instruction was recorded, or its native code found a decimal
+  NativeCode *loops; // Native code of the loop that ends at each instruction
+  Array *pages;
+  i32 *frames; // Return addresses the machine pushes on its call stack before it continues
+  i32 frame_count;
+  i32 frame_capacity;
+} Jit;
+
+// Machine code being written
+typedef struct {
+  u8 *bytes;
+  i32 length;
+  i32 capacity;
+} CodeBuffer;
+
+// Jump in the machine code whose 32 bit offset is written once its target is known
+typedef struct {
+  i32 offset; // Position of the offset in the code
+  i32 target; // Label, or exit when it is at least JIT_EXIT
+} NativeJump;
+
+// Instruction a trace ran, and for a branch whether it jumped
+typedef struct {
+  i32 instruction;
+  bool taken;
+} TraceStep;
+
+// Recorded path through an iteration of a loop, the first one starts at the top and the others at a guard of an earlier path whose side exit got hot
+typedef struct {
+  Array *steps;
+  i32 origin_path; // -1 for the first path
+  i32 origin_step;
+  Array *frames; // Return addresses of the calls the path starts in
+} TracePath;
+
+// Loop being translated
+typedef struct {
+  CodeBuffer code;
+  Array *jumps;
+  Array *labels; // Positions in the code that jumps go to
+  Array *exits;
+  Array *frames; // Return addresses of the exits
+  i32 *uses; // Times each register is used
+  bool *written; // Set for the registers the loop changes
+  i8 *places; // Processor register of each register, -1 for the ones that stay in the register array
+  i32 saved_count; // Processor registers that have to be saved
+} NativeBuilder;
+
+// Iterations after which a loop is translated to native code
+const u32 JIT_HOT_LOOP = 1000;
+
+// Times the native code of a loop may find a decimal, or its trace can't be recorded, before the loop is left to the machine
+const u32 JIT_MAX_BAILS = 16;
+
+// Most instructions a path of a trace can have
+const i32 JIT_MAX_TRACE = 512;
+
+// Times a side exit is taken before the path from it to the end of the iteration is recorded and added to the trace
+const u32 JIT_HOT_EXIT = 64;
+
+// Most paths a trace can have
+const i32 JIT_MAX_PATHS = 8;
+
+// Heat of a jump whose loop can't be translated
+const u32 JIT_OFF = 0xFFFFFFFF;
+
+// Targets of native jumps at or above this are exits, numbered from it, and the one below it is the exit for a decimal
+const i32 JIT_EXIT = 1 << 30;
+
+// Processor registers that can hold machine registers, starting with those that don't have to be saved
+const u8 host_registers[] = {1, 2, 6, 8, 9, 10, 11, 3, 5, 12, 13, 14, 15}; // rcx, rdx, rsi, r8 to r11, rbx, rbp, r12 to r15
+#define HOST_REGISTER_COUNT 13
+#define HOST_SAVED_START 7
+
+// Processor registers the code itself uses: rax for intermediate values, and rdi for the address of the register array
+#define RAX 0
+#define RDI 7
+
+void code_byte(CodeBuffer *code, u8 byte) {
+  if (code->length == code->capacity) {
+    code->capacity = code->capacity == 0 ? 4096 : code->capacity * 2;
+    code->bytes = realloc(code->bytes, code->capacity);
+    if (code->bytes == NULL) {
+      printf("Memory allocation failed in code_byte\n");
+      exit(1);
+    }
+  }
+  code->bytes[code->length] = byte;
+  code->length += 1;
+}
+
+void code_word(CodeBuffer *code, i32 word) {
+  for (i32 i = 0; i < 4; i++) {
+    code_byte(code, (u8)((u32)word >> (8 * i)));
+  }
+}
+
+// Writes an instruction with a processor register operand and an operand that is a machine register, in its processor register if it has one and in the register array otherwise
+void code_operand(CodeBuffer *code, u8 opcode, bool extended, u8 reg, i32 machine_register, i8 *places) {
+  i32 place = places == 0 ? -1 : places[machine_register];
+  u8 rm = place >= 0 ? (u8)place : RDI;
+  code_byte(code, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+  if (extended) {
+    code_byte(code, 0x0F);
+  }
+  code_byte(code, opcode);
+  if (place >= 0) {
+    code_byte(code, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+  } else {
+    code_byte(code, 0x80 | ((reg & 7) << 3) | RDI);
+    code_word(code, machine_register * (i32)sizeof(Number) + (i32)offsetof(Number, value));
+  }
+}
+
+// Writes a move between a processor register and the register array
+void code_memory(CodeBuffer *code, bool store, u8 reg, i32 machine_register) {
+  code_operand(code, store ? 0x89 : 0x8B, false, reg, machine_register, 0);
+}
+
+// Writes a jump with an offset that is filled in later, with condition code 0 for a jump that is always taken
+void code_jump(NativeBuilder *builder, u8 condition, i32 target) {
+  CodeBuffer *code = &builder->code;
+  if (condition == 0) {
+    code_byte(code, 0xE9);
+  } else {
+    code_byte(code, 0x0F);
+    code_byte(code, 0x80 | condition);
+  }
+  NativeJump jump = {.offset = code->length, .target = target};
+  array_push(builder->jumps, &jump);
+  code_word(code, 0);
+}
+
+void code_push(CodeBuffer *code, u8 reg, bool pop) {
+  if (reg >= 8) {
+    code_byte(code, 0x41);
+  }
+  code_byte(code, (pop ? 0x58 : 0x50) + (reg & 7));
+}
+
+// Restores the saved processor registers and returns
+void code_return(CodeBuffer *code, i32 saved_count) {
+  for (i32 i = HOST_SAVED_START + saved_count - 1; i >= HOST_SAVED_START; i--) {
+    code_push(code, host_registers[i], true);
+  }
+  code_byte(code, 0xC3);
+}
+
+// Returns the x86 condition code that holds when a jump of the machine is taken, or when it isn't
+u8 jump_condition(u8 opcode, bool taken) {
+  u8 condition = 0xD;
+  if (opcode == op_jump_if_equal) {
+    condition = 0x4;
+  } else if (opcode == op_jump_if_not_equal) {
+    condition = 0x5;
+  } else if (opcode == op_jump_if_less) {
+    condition = 0xC;
+  } else if (opcode == op_jump_if_greater) {
+    condition = 0xF;
+  } else if (opcode == op_jump_if_less_equal) {
+    condition = 0xE;
+  }
+  // Condition codes come in pairs that only differ in the lowest bit
+  return taken ? condition : condition ^ 1;
+}
+
+bool is_native(u8 opcode) {
+  return opcode == op_move || opcode == op_add || opcode == op_subtract || opcode == op_multiply || opcode == op_increment || opcode == op_negate || (opcode >= op_jump_if_equal && opcode <= op_jump);
+}
+
+// Writes a = b op c for an operation with the opcode of `op r64, r/m64`
+void code_arithmetic(CodeBuffer *code, u8 opcode, bool extended, Instruction *instruction, i8 *places) {
+  i32 a = instruction->a;
+  // The result is computed in the register of a, unless c is read from there
+  u8 result = places[a] >= 0 && a != instruction->c ? (u8)places[a] : RAX;
+  if (!(result != RAX && a == instruction->b)) {
+    code_operand(code, 0x8B, false, result, instruction->b, places);
+  }
+  code_operand(code, opcode, extended, result, instruction->c, places);
+  if (result == RAX) {
+    code_operand(code, 0x89, false, RAX, a, places);
+  }
+}
+
+// Writes an instruction that isn't a jump
+void code_instruction(CodeBuffer *code, Instruction *instruction, i8 *places) {
+  u8 opcode = instruction->code;
+  if (opcode == op_add) {
+    code_arithmetic(code, 0x03, false, instruction, places);
+  } else if (opcode == op_subtract) {
+    code_arithmetic(code, 0x2B, false, instruction, places);
+  } else if (opcode == op_multiply) {
+    code_arithmetic(code, 0xAF, true, instruction, places);
+  } else {
+    // a = b, then a is changed in place
+    if (instruction->a != instruction->b) {
+      u8 result = places[instruction->a] >= 0 ? (u8)places[instruction->a] : RAX;
+      code_operand(code, 0x8B, false, result, instruction->b, places);
+      if (result == RAX) {
+        code_operand(code, 0x89, false, RAX, instruction->a, places);
+      }
+    }
+    if (opcode == op_increment) {
+      code_operand(code, 0x81, false, 0, instruction->a, places);
+      code_word(code, instruction->c);
+    } else if (opcode == op_negate) {
+      code_operand(code, 0xF7, false, 3, instruction->a, places);
+    }
+  }
+}
+
+// Writes the comparison of a conditional jump, which sets the flags for a condition code
+void code_compare(CodeBuffer *code, Instruction *instruction, i8 *places) {
+  u8 left = places[instruction->b] >= 0 ? (u8)places[instruction->b] : RAX;
+  if (left == RAX) {
+    code_operand(code, 0x8B, false, RAX, instruction->b, places);
+  }
+  code_operand(code, 0x3B, false, left, instruction->c, places);
+}
+
+// Returns the number of an exit, adding it if no exit continues at the same place, side exits of guards get their own
+i32 add_exit(NativeBuilder *builder, i32 resume, i32 *frames, i32 frame_count, i32 path, i32 step) {
+  for (i32 e = 0; path < 0 && e < array_length(builder->exits); e++) {
+    NativeExit *exit = (NativeExit *)array_get(builder->exits, e);
+    if (exit->resume == resume && exit->path < 0) return e;
+  }
+  NativeExit exit = {.resume = resume, .first_frame = array_length(builder->frames), .frame_count = frame_count, .path = path, .step = step, .count = 0};
+  for (i32 i = 0; i < frame_count; i++) {
+    array_push(builder->frames, &frames[i]);
+  }
+  array_push(builder->exits, &exit);
+  return array_last(builder->exits);
+}
+
+// Counts how the instructions of a loop use the registers
+void count_registers(NativeBuilder *builder, Instruction *instruction) {
+  u8 opcode = instruction->code;
+  if (opcode >= op_jump_if_equal && opcode <= op_jump_if_greater_equal) {
+    builder->uses[instruction->b] += 1;
+    builder->uses[instruction->c] += 1;
+  } else if (opcode < op_jump_if_equal) {
+    builder->uses[instruction->a] += 1;
+    builder->uses[instruction->b] += 1;
+    builder->written[instruction->a] = true;
+    if (opcode != op_move && opcode != op_increment && opcode != op_negate) {
+      builder->uses[instruction->c] += 1;
+    }
+  }
+}
+
+void start_builder(NativeBuilder *builder, i32 register_count) {
+  builder->code = (CodeBuffer){.bytes = 0, .length = 0, .capacity = 0};
+  builder->jumps = array_create(arena, sizeof(NativeJump));
+  builder->labels = array_create(arena, sizeof(i32));
+  builder->exits = array_create(arena, sizeof(NativeExit));
+  builder->frames = array_create(arena, sizeof(i32));
+  builder->uses = calloc(register_count, sizeof(i32));
+  builder->written = calloc(register_count, sizeof(bool));
+  builder->places = malloc(register_count * sizeof(i8));
+  if (builder->uses == NULL || builder->written == NULL || builder->places == NULL) {
+    printf("Memory allocation failed in start_builder\n");
+    exit(1);
+  }
+  memset(builder->places, -1, register_count * sizeof(i8));
+  builder->saved_count = 0;
+}
+
+// Gives the registers that are used most the processor registers, and writes the start of the native code: saving processor registers, checking that every register the loop uses holds an integer, and loading them
+void code_entry(NativeBuilder *builder, i32 register_count) {
+  i32 *uses = builder->uses;
+  i8 *places = builder->places;
+  for (i32 h = 0; h < HOST_REGISTER_COUNT; h++) {
+    i32 most = -1;
+    for (i32 r = 0; r < register_count; r++) {
+      if (uses[r] > 0 && places[r] < 0 && (most < 0 || uses[r] > uses[most])) {
+        most = r;
+      }
+    }
+    if (most < 0) break;
+    places[most] = (i8)host_registers[h];
+    if (h >= HOST_SAVED_START) {
+      builder->saved_count += 1;
+    }
+  }
+  CodeBuffer *code = &builder->code;
+  for (i32 i = HOST_SAVED_START; i < HOST_SAVED_START + builder->saved_count; i++) {
+    code_push(code, host_registers[i], false);
+  }
+  for (i32 r = 0; r < register_count; r++) {
+    if (uses[r] == 0) continue;
+    code_byte(code, 0x66);
+    code_byte(code, 0x83);
+    code_byte(code, 0xBF);
+    code_word(code, r * (i32)sizeof(Number) + (i32)offsetof(Number, exponent));
+    code_byte(code, 0);
+    code_jump(builder, 0x5, JIT_EXIT - 1);
+  }
+  for (i32 r = 0; r < register_count; r++) {
+    if (places[r] >= 0) {
+      code_memory(code, false, (u8)places[r], r);
+    }
+  }
+}
+
+// Writes the exits, which store the changed registers and return their number, fills in the jumps and makes the code executable, returns 0 if it can't get pages for it
+NativeCode finish_builder(Jit *jit, NativeBuilder *builder, i32 register_count) {
+  CodeBuffer *code = &builder->code;
+  i32 exit_count = array_length(builder->exits);
+  i32 *exit_addresses = malloc((exit_count + 1) * sizeof(i32));
+  if (exit_addresses == NULL) {
+    printf("Memory allocation failed in finish_builder\n");
+    exit(1);
+  }
+  for (i32 e = 0; e <= exit_count; e++) {
+    exit_addresses[e] = code->length;
+    // The last exit is the one for a decimal, which happens before anything is changed
+    for (i32 r = 0; e < exit_count && r < register_count; r++) {
+      if (builder->written[r] && builder->places[r] >= 0) {
+        code_memory(code, true, (u8)builder->places[r], r);
+      }
+    }
+    code_byte(code, 0xB8);
+    code_word(code, e < exit_count ? e : -1);
+    code_return(code, builder->saved_count);
+  }
+  for (i32 j = 0; j < array_length(builder->jumps); j++) {
+    NativeJump *jump = (NativeJump *)array_get(builder->jumps, j);
+    i32 address = exit_addresses[exit_count];
+    if (jump->target < JIT_EXIT - 1) {
+      address = *(i32 *)array_get(builder->labels, jump->target);
+    } else if (jump->target >= JIT_EXIT) {
+      address = exit_addresses[jump->target - JIT_EXIT];
+    }
+    i32 offset = address - (jump->offset + 4);
+    memcpy(code->bytes + jump->offset, &offset, sizeof(i32));
+  }
+  free(exit_addresses);
+  free(builder->uses);
+  free(builder->written);
+  free(builder->places);
+
+  NativeCode native = {.code = 0, .exits = 0, .frames = 0, .paths = 0};
+  // The pages are only made executable once the code is written
+  CodePages pages = {.address = 0, .size = (code->length + 4095) & ~(i64)4095};
+  pages.address = mmap(0, pages.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages.address == MAP_FAILED) {
+    free(code->bytes);
+    return native;
+  }
+  memcpy(pages.address, code->bytes, code->length);
+  free(code->bytes);
+  if (mprotect(pages.address, pages.size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(pages.address, pages.size);
+    return native;
+  }
+  array_push(jit->pages, &pages);
+  native.code = (NativeLoop)pages.address;
+  native.exits = (NativeExit *)arena_fill(arena, (exit_count + 1) * sizeof(NativeExit));
+  for (i32 e = 0; e < exit_count; e++) {
+    native.exits[e] = *(NativeExit *)array_get(builder->exits, e);
+  }
+  i32 frame_count = array_length(builder->frames);
+  native.frames = (i32 *)arena_fill(arena, (frame_count + 1) * sizeof(i32));
+  for (i32 i = 0; i < frame_count; i++) {
+    native.frames[i] = *(i32 *)array_get(builder->frames, i);
+  }
+  return native;
+}
+
+// Translates the instructions from start to end as they are, with a label for each of them
+NativeCode compile_loop(Jit *jit, i32 start, i32 end) {
+  Program *program = jit->program;
+  Instruction *instructions = program->code;
+  NativeCode native = {.code = 0, .exits = 0, .frames = 0, .paths = 0};
+  for (i32 i = start; i <= end; i++) {
+    if (!is_native(instructions[i].code)) return native;
+  }
+  NativeBuilder builder;
+  start_builder(&builder, program->register_count);
+  for (i32 i = start; i <= end; i++) {
+    count_registers(&builder, &instructions[i]);
+  }
+  code_entry(&builder, program->register_count);
+  for (i32 i = start; i <= end; i++) {
+    Instruction *instruction = &instructions[i];
+    array_push(builder.labels, &builder.code.length);
+    u8 opcode = instruction->code;
+    if (opcode >= op_jump_if_equal && opcode <= op_jump) {
+      if (opcode != op_jump) {
+        code_compare(&builder.code, instruction, builder.places);
+      }
+      i32 target = instruction->a;
+      // A jump out of the loop goes through the exit for its target
+      if (target < start || target > end) {
+        target = JIT_EXIT + add_exit(&builder, target, 0, 0, -1, 0);
+      } else {
+        target -= start;
+      }
+      code_jump(&builder, opcode == op_jump ? 0 : jump_condition(opcode, true), target);
+    } else {
+      code_instruction(&builder.code, instruction, builder.places);
+    }
+  }
+  // Running past the last instruction leaves the loop too
+  if (instructions[end].code != op_jump) {
+    code_jump(&builder, 0, JIT_EXIT + add_exit(&builder, end + 1, 0, 0, -1, 0));
+  }
+  return finish_builder(jit, &builder, program->register_count);
+}
+
+// Translates the recorded paths through an iteration of a loop into straight code with guards, where a guard that another path starts at continues in that path
+NativeCode compile_trace(Jit *jit, Array *paths) {
+  Program *program = jit->program;
+  Instruction *instructions = program->code;
+  NativeBuilder builder;
+  start_builder(&builder, program->register_count);
+  i32 longest = 0;
+  for (i32 p = 0; p < array_length(paths); p++) {
+    Array *steps = ((TracePath *)array_get(paths, p))->steps;
+    for (i32 i = 0; i < array_length(steps); i++) {
+      count_registers(&builder, &instructions[((TraceStep *)array_get(steps, i))->instruction]);
+    }
+    if (array_length(steps) > longest) {
+      longest = array_length(steps);
+    }
+  }
+  code_entry(&builder, program->register_count);
+  // Label 0 is the top of the loop, and label 1 + p the start of path p
+  array_push(builder.labels, &builder.code.length);
+  // Return addresses of the calls the path is in
+  i32 *frames = malloc((longest + JIT_MAX_TRACE + 1) * sizeof(i32));
+  if (frames == NULL) {
+    printf("Memory allocation failed in compile_trace\n");
+    exit(1);
+  }
+  for (i32 p = 0; p < array_length(paths); p++) {
+    TracePath *path = (TracePath *)array_get(paths, p);
+    array_push(builder.labels, &builder.code.length);
+    i32 frame_count = array_length(path->frames);
+    for (i32 i = 0; i < frame_count; i++) {
+      frames[i] = *(i32 *)array_get(path->frames, i);
+    }
+    i32 last = array_length(path->steps) - 1;
+    for (i32 i = 0; i <= last; i++) {
+      TraceStep *step = (TraceStep *)array_get(path->steps, i);
+      Instruction *instruction = &instructions[step->instruction];
+      u8 opcode = instruction->code;
+      if (opcode == op_call) {
+        frames[frame_count] = step->instruction + 1;
+        frame_count += 1;
+      } else if (opcode == op_return) {
+        frame_count -= 1;
+      } else if (opcode == op_jump) {
+        if (i == last) {
+          code_jump(&builder, 0, 0);
+        }
+      } else if (opcode >= op_jump_if_equal && opcode <= op_jump_if_greater_equal) {
+        code_compare(&builder.code, instruction, builder.places);
+        i32 other = step->taken ? step->instruction + 1 : instruction->a;
+        if (i == last) {
+          // The jump that closes the loop goes back to the top, and leaves the loop when it isn't taken
+          code_jump(&builder, jump_condition(opcode, true), 0);
+          code_jump(&builder, 0, JIT_EXIT + add_exit(&builder, other, 0, 0, -1, 0));
+          continue;
+        }
+        i32 target = JIT_EXIT + add_exit(&builder, other, frames, frame_count, p, i);
+        for (i32 q = p + 1; q < array_length(paths); q++) {
+          TracePath *bridge = (TracePath *)array_get(paths, q);
+          if (bridge->origin_path == p && bridge->origin_step == i) {
+            target = 1 + q;
+          }
+        }
+        code_jump(&builder, jump_condition(opcode, !step->taken), target);
+      } else {
+        code_instruction(&builder.code, instruction, builder.places);
+      }
+    }
+  }
+  free(frames);
+  NativeCode native = finish_builder(jit, &builder, program->register_count);
+  native.paths = paths;
+  return native;
+}
+
+// Result of the comparison of a conditional jump, like the machine computes it
+bool jit_condition(Instruction *instruction, Number *registers) {
+  u8 opcode = instruction->code;
+  if (opcode == op_jump_if_equal) return VM_COMPARE(==);
+  if (opcode == op_jump_if_not_equal) return VM_COMPARE(!=);
+  if (opcode == op_jump_if_less) return VM_COMPARE(<);
+  if (opcode == op_jump_if_greater) return VM_COMPARE(>);
+  if (opcode == op_jump_if_less_equal) return VM_COMPARE(<=);
+  return VM_COMPARE(>=);
+}
+
+void push_frame(Jit *jit, i32 address) {
+  if (jit->frame_count == jit->frame_capacity) {
+    jit->frame_capacity = jit->frame_capacity == 0 ? 16 : jit->frame_capacity * 2;
+    jit->frames = realloc(jit->frames, jit->frame_capacity * sizeof(i32));
+    if (jit->frames == NULL) {
+      printf("Memory allocation failed in push_frame\n");
+      exit(1);
+    }
+  }
+  jit->frames[jit->frame_count] = address;
+  jit->frame_count += 1;
+}
+
+// Runs the rest of an iteration of the loop that ends with a jump back like the machine does, from its top or from a side exit, and records it. Returns the instruction the machine continues at, with the calls the recorder is in as frames, and translates the loop with the new path if the iteration went back to its top
+i32 record_trace(Jit *jit, Number *registers, i32 jump, NativeExit *origin) {
+  Instruction *code = jit->program->code;
+  Array *trace = array_create(arena, sizeof(TraceStep));
+  i32 index = origin == 0 ? code[jump].a : origin->resume;
+  TracePath path = {.steps = trace, .origin_path = origin == 0 ? -1 : origin->path, .origin_step = origin == 0 ? 0 : origin->step};
+  path.frames = array_create(arena, sizeof(i32));
+  for (i32 i = 0; i < jit->frame_count; i++) {
+    array_push(path.frames, &jit->frames[i]);
+  }
+  while (true) {
+    Instruction *instruction = &code[index];
+    u8 opcode = instruction->code;
+    TraceStep step = {.instruction = index, .taken = false};
+    // Anything the native code can't do, an inner loop or a return from the function of the loop ends the recording before the instruction runs
+    if (array_length(trace) == JIT_MAX_TRACE || (!is_native(opcode) && opcode != op_call && opcode != op_return)) break;
+    if (opcode == op_return && jit->frame_count == 0) break;
+    if (opcode >= op_jump_if_equal && opcode <= op_jump) {
+      step.taken = opcode == op_jump || jit_condition(instruction, registers);
+      if (index == jump) {
+        if (jit->frame_count > 0) break;
+        array_push(trace, &step);
+        if (!step.taken) return index + 1;
+        NativeCode *native = &jit->loops[jump];
+        Array *paths = native->paths;
+        if (paths == 0) {
+          paths = array_create(arena, sizeof(TracePath));
+        }
+        array_push(paths, &path);
+        NativeCode translated = compile_trace(jit, paths);
+        if (translated.code != 0) {
+          *native = translated;
+        } else if (native->code == 0) {
+          jit->heat[jump] = JIT_OFF;
+        }
+        return instruction->a;
+      }
+      if (step.taken && instruction->a <= index) break;
+      array_push(trace, &step);
+      index = step.taken ? instruction->a : index + 1;
+    } else if (opcode == op_call) {
+      array_push(trace, &step);
+      push_frame(jit, index + 1);
+      index = instruction->a;
+    } else if (opcode == op_return) {
+      array_push(trace, &step);
+      jit->frame_count -= 1;
+      index = jit->frames[jit->frame_count];
+    } else {
+      array_push(trace, &step);
+      if (opcode == op_increment) {
+        VM_INCREMENT();
+      } else if (opcode == op_negate) {
+        VM_NEGATE();
+      } else if (opcode == op_move) {
+        registers[instruction->a] = registers[instruction->b];
+      } else if (opcode == op_add) {
+        VM_ARITHMETIC(+, number_add);
+      } else if (opcode == op_subtract) {
+        VM_ARITHMETIC(-, number_subtract);
+      } else {
+        VM_ARITHMETIC(*, number_multiply);
+      }
+      index += 1;
+    }
+  }
+  // A path from a side exit that can't be recorded leaves the exit as it is
+  if (origin != 0) return index;
+  jit->tries[jump] += 1;
+  if (jit->tries[jump] >= JIT_MAX_BAILS) {
+    jit->heat[jump] = JIT_OFF;
+  }
+  return index;
+}
+
+// jit_create: sets up the loop counters for a program
+Jit jit_create(Program *program) {
+  Jit jit = {.program = program, .frames = 0, .frame_count = 0, .frame_capacity = 0};
+  jit.heat = calloc(program->length, sizeof(u32));
+  jit.tries = calloc(program->length, sizeof(u32));
+  jit.loops = calloc(program->length, sizeof(NativeCode));
+  if (jit.heat == NULL || jit.tries == NULL || jit.loops == NULL) {
+    printf("Memory allocation failed in jit_create\n");
+    exit(1);
+  }
+  jit.pages = array_create(arena, sizeof(CodePages));
+  return jit;
+}
+
+// jit_run_loop: counts an iteration of the loop that ends with a jump back, and runs the loop as native code once it's hot. Returns the instruction the machine continues at after pushing the frames of the jit on its call stack, or -1 if the machine runs the loop
+i32 jit_run_loop(Jit *jit, Number *registers, i32 jump) {
+  jit->frame_count = 0;
+  NativeCode *native = &jit->loops[jump];
+  if (native->code == 0) {
+    jit->heat[jump] += 1;
+    if (jit->heat[jump] < JIT_HOT_LOOP) return -1;
+    if (jit->heat[jump] == JIT_HOT_LOOP) {
+      *native = compile_loop(jit, jit->program->code[jump].a, jump);
+    }
+    if (native->code == 0) {
+      return record_trace(jit, registers, jump, 0);
+    }
+  }
+  i32 exit_number = native->code(registers);
+  if (exit_number < 0) {
+    jit->tries[jump] += 1;
+    if (jit->tries[jump] >= JIT_MAX_BAILS) {
+      jit->heat[jump] = JIT_OFF;
+    }
+    return -1;
+  }
+  NativeExit *taken = &native->exits[exit_number];
+  for (i32 i = 0; i < taken->frame_count; i++) {
+    push_frame(jit, native->frames[taken->first_frame + i]);
+  }
+  // A side exit that is taken often gets a path of its own
+  if (taken->path >= 0) {
+    taken->count += 1;
+    if (taken->count == JIT_HOT_EXIT && array_length(native->paths) < JIT_MAX_PATHS) {
+      return record_trace(jit, registers, jump, taken);
+    }
+  }
+  return taken->resume;
+}
+
+// jit_free: unmaps the native code
+void jit_free(Jit *jit) {
+  for (i32 i = 0; i < array_length(jit->pages); i++) {
+    CodePages *pages = (CodePages *)array_get(jit->pages, i);
+    munmap(pages->address, pages->size);
+  }
+  free(jit->heat);
+  free(jit->tries);
+  free(jit->loops);
+  free(jit->frames);
+}
+
+#endif
+
+#define TARZAN_JIT
+#endif
@@ -0,0 +1,213 @@
+#ifndef TARZAN_OPTIMIZER
+
+/*
+
+Optimizer that simplifies the statement tree of the compiler before instructions are generated. It has the following functions:
+- optimize_statements: optimizes a list of statements and everything nested in them
+- hoist_invariants: moves the parts of while loops that are the same in every iteration to before the loops
+
+Operations on constants are computed once here instead of every time they run, so `(2 + 3) * x` becomes `5 * x`. Operations that can't change their other operand are dropped, so `x * 1`, `x + 0` and `x - 0` become `x` and `x * 0` becomes `0`. A variable that is only ever assigned by its declaration is replaced by the value it's declared with when that value is a constant, so with `num count = 1000;` the condition `i < count * 10` becomes `i < 10000`.
+
+Constant results are computed with the same arithmetic the machine uses. Divisions depend on the precision and rounding settings at the time they run, so they are only computed here when the file never changes those settings.
+
+An operation in a while loop whose variables are never assigned in the loop body, counting the bodies of the snippets it uses, has the same value in every iteration. It's computed once into a register of its own before the loop instead. Outer loops are handled first, so an operation moves out of as many loops as it can. Operations have no side effects, so computing one for a loop that never runs changes nothing.
+
+*/
+
+Array *added_registers = 0; // Starting values of the registers added by the optimizer
+i32 loop_mark = 0; // Number of loops that had their assigned variables collected
+Statement **hoisted_last = 0; // Where the next assignment moved out of the current loop is linked
+bool hoist_divisions = false; // Set when divisions can be moved out of the current loop
+
+// Adds a register with a starting value and returns its number, which is negative until the generator places the added registers after all others
+i32 add_register(Number value) {
+  array_push(added_registers, &value);
+  return -array_length(added_registers);
+}
+
+// Makes a constant expression for a value computed by the optimizer
+Expression *fold_constant(Number value) {
+  Expression *expression = new_expression(expression_kinds.constant, 0, add_register(value), 0, 0);
+  expression->value = value;
+  return expression;
+}
+
+// Computes an operation on two constants exactly like the machine would
+Number fold_operation(u8 op_code, Number a, Number b) {
+  bool integers = (a.exponent | b.exponent) == 0;
+  if (op_code == operators.plus) {
+    return integers ? (Number){.value = (i64)((u64)a.value + (u64)b.value), .exponent = 0} : number_compact(number_add(a, b));
+  } else if (op_code == operators.minus) {
+    return integers ? (Number){.value = (i64)((u64)a.value - (u64)b.value), .exponent = 0} : number_compact(number_subtract(a, b));
+  } else if (op_code == operators.multiply) {
+    return integers ? (Number){.value = (i64)((u64)a.value * (u64)b.value), .exponent = 0} : number_compact(number_multiply(a, b));
+  }
+  return number_divide(a, b, division_precision, division_rounding);
+}
+
+bool is_constant(Expression *expression, i64 value) {
+  return expression->kind == expression_kinds.constant && number_compare(expression->value, (Number){.value = value, .exponent = 0}) == 0;
+}
+
+// Returns a simplified version of an expression
+Expression *optimize_expression(Expression *expression) {
+  if (expression->kind == expression_kinds.variable) {
+    Binding *binding = expression->binding;
+    if (binding != 0 && binding->assignments == 1 && binding->value != 0) {
+      binding->value = optimize_expression(binding->value);
+      if (binding->value->kind == expression_kinds.constant) {
+        return binding->value;
+      }
+    }
+    return expression;
+  }
+  if (expression->kind == expression_kinds.negation) {
+    expression->left = optimize_expression(expression->left);
+    if (expression->left->kind == expression_kinds.constant) {
+      return fold_constant((Number){.value = (i64)(0 - (u64)expression->left->value.value), .exponent = expression->left->value.exponent});
+    }
+    return expression;
+  }
+  if (expression->kind != expression_kinds.operation) {
+    return expression;
+  }
+  Expression *left = optimize_expression(expression->left);
+  Expression *right = optimize_expression(expression->right);
+  u8 op_code = expression->op_code;
+  if (left->kind == expression_kinds.constant && right->kind == expression_kinds.constant && (op_code != operators.divide || !division_settings_used)) {
+    return fold_constant(fold_operation(op_code, left->value, right->value));
+  }
+  if (op_code == operators.plus) {
+    if (is_constant(left, 0)) return right;
+    if (is_constant(right, 0)) return left;
+  } else if (op_code == operators.minus) {
+    if (is_constant(right, 0)) return left;
+  } else if (op_code == operators.multiply) {
+    if (is_constant(left, 1)) return right;
+    if (is_constant(right, 1)) return left;
+    if (is_constant(left, 0)) return left;
+    if (is_constant(right, 0)) return right;
+  }
+  expression->left = left;
+  expression->right = right;
+  return expression;
+}
+
+// optimize_statements: optimizes a list of statements and everything nested in them
+void optimize_statements(Statement *statement) {
+  while (statement != 0) {
+    if (statement->value != 0) {
+      statement->value = optimize_expression(statement->value);
+    }
+    if (statement->right != 0) {
+      statement->right = optimize_expression(statement->right);
+    }
+    optimize_statements(statement->body);
+    optimize_statements(statement->otherwise);
+    statement = statement->next;
+  }
+}
+
+// Marks every variable assigned by the statements, including the ones nested in them and in the snippets they use
+// Returns true if the statements change the precision or rounding of divisions
+bool mark_assignments(Statement *statement) {
+  bool settings_changed = false;
+  while (statement != 0) {
+    if (statement->kind == statement_kinds.assign && statement->binding != 0) {
+      statement->binding->loop_mark = loop_mark;
+    } else if (statement->kind == statement_kinds.precision || statement->kind == statement_kinds.rounding) {
+      settings_changed = true;
+    } else if (statement->kind == statement_kinds.call && statement->instance->loop_mark != loop_mark) {
+      statement->instance->loop_mark = loop_mark;
+      settings_changed |= mark_assignments(statement->instance->body);
+    }
+    settings_changed |= mark_assignments(statement->body);
+    settings_changed |= mark_assignments(statement->otherwise);
+    statement = statement->next;
+  }
+  return settings_changed;
+}
+
+// Returns true if an expression has the same value in every iteration of the loop whose assignments are marked
+bool is_invariant(Expression *expression, bool divisions) {
+  if (expression->kind == expression_kinds.variable) {
+    return expression->binding == 0 || expression->binding->loop_mark != loop_mark;
+  } else if (expression->kind == expression_kinds.negation) {
+    return is_invariant(expression->left, divisions);
+  } else if (expression->kind == expression_kinds.operation) {
+    if (expression->op_code == operators.divide && !divisions) return false;
+    return is_invariant(expression->left, divisions) && is_invariant(expression->right, divisions);
+  }
+  return true;
+}
+
+// Replaces the largest invariant operations in an expression with registers that are assigned before the loop
+Expression *hoist_expression(Expression *expression) {
+  if (expression->kind == expression_kinds.constant || expression->kind == expression_kinds.variable) {
+    return expression;
+  }
+  if (is_invariant(expression, hoist_divisions)) {
+    Statement *assignment = (Statement *)arena_fill(arena, sizeof(Statement));
+    memset(assignment, 0, sizeof(Statement));
+    assignment->kind = statement_kinds.assign;
+    assignment->reg = add_register((Number){.value = 0, .exponent = 0});
+    assignment->value = expression;
+    *hoisted_last = assignment;
+    hoisted_last = &assignment->next;
+    return new_expression(expression_kinds.variable, 0, assignment->reg, 0, 0);
+  }
+  expression->left = hoist_expression(expression->left);
+  if (expression->right != 0) {
+    expression->right = hoist_expression(expression->right);
+  }
+  return expression;
+}
+
+// Replaces the invariant operations in a loop body, nested statements included
+void hoist_from_statements(Statement *statement) {
+  while (statement != 0) {
+    if (statement->value != 0) {
+      statement->value = hoist_expression(statement->value);
+    }
+    if (statement->right != 0) {
+      statement->right = hoist_expression(statement->right);
+    }
+    hoist_from_statements(statement->body);
+    hoist_from_statements(statement->otherwise);
+    statement = statement->next;
+  }
+}
+
+// hoist_invariants: moves the parts of while loops that are the same in every iteration to before the loops
+void hoist_invariants(Statement *statement) {
+  while (statement != 0) {
+    Statement *next = statement->next;
+    if (statement->kind == statement_kinds.loop) {
+      loop_mark += 1;
+      hoist_divisions = !mark_assignments(statement->body);
+      Statement *hoisted = 0;
+      hoisted_last = &hoisted;
+      Statement *loop = (Statement *)arena_fill(arena, sizeof(Statement));
+      *loop = *statement;
+      loop->next = 0;
+      loop->value = hoist_expression(loop->value);
+      loop->right = hoist_expression(loop->right);
+      hoist_from_statements(loop->body);
+      if (hoisted != 0) {
+        // The loop becomes a block of the hoisted assignments followed by the loop
+        *hoisted_last = loop;
+        memset(statement, 0, sizeof(Statement));
+        statement->kind = statement_kinds.block;
+        statement->body = hoisted;
+        statement->next = next;
+        statement = loop;
+      }
+    }
+    hoist_invariants(statement->body);
+    hoist_invariants(statement->otherwise);
+    statement = next;
+  }
+}
+
+#define TARZAN_OPTIMIZER
+#endif
@@ -0,0 +1,16 @@
+#!/bin/bash
+# usage: run.sh file.tzn
+f=$1
+B=/tmp/base/tz_base; N=/tmp/tarzan_gcc
+strip() { grep -v '^Tarzan done'; }
+rm -f ${f%.tzn}.tzc
+timeout 10 $B $f 2>&1 | python3 /tmp/t/conv.py > /tmp/t/o_base
+timeout 10 $N --interpret $f 2>&1 | strip > /tmp/t/o_int
+timeout 10 $N $f 2>&1 | strip > /tmp/t/o_tier
+timeout 10 $N --compile $f 2>&1 | strip > /tmp/t/o_comp
+timeout 10 $N $f 2>&1 | strip > /tmp/t/o_cached
+rm -f ${f%.tzn}.tzc
+if timeout 10 $N --emit-c $f > /tmp/t/o.c 2>/tmp/t/o_emit_err; then gcc -std=c99 -O2 -I /root/repo /tmp/t/o.c -o /tmp/t/o_bin -lm 2>/tmp/t/o_cc_err && timeout 10 /tmp/t/o_bin 2>&1 | strip > /tmp/t/o_aot || echo "AOT build fail" > /tmp/t/o_aot; else echo "no-aot" > /tmp/t/o_aot; fi
+for m in int tier comp cached aot; do
+  if ! cmp -s /tmp/t/o_base /tmp/t/o_$m; then echo "== $f: base vs $m differ"; diff /tmp/t/o_base /tmp/t/o_$m | head -10; fi
+done
@@ -1,13 +1,24 @@
-#include <math.h> // pow
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS with -std=c99
+
 #include <stdbool.h> // bool
 #include <stdio.h> // printf, FILE
 #include <stdlib.h> // fopen, fclose
 #include <string.h> // strlen, strcmp, memcpy
 #include <time.h> // clock, CLOCKS_PER_SEC
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MAP_SOURCE
+#include <fcntl.h> // open, O_RDONLY
+#include <sys/mman.h> // mmap, madvise, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close, sysconf
+#endif
+
 #include "include/types.c" // i32
 #include "include/arena.c" // arena
 #include "include/array.c" // array
+#include "include/map.c" // map
+#include "include/number.c" // Number, number_parse, number_format, number_divide
 
 // Tarzan is a tiny interpreted language with C-like syntax. This file includes a simple line-by-line interpreter.
 
@@ -25,33 +36,82 @@
 // - [x] Add scope to variables by block level, removing current block level variables on block end
 
 // Global variables
-u8 *file_data = 0; // File data
+u8 *file_data = 0; // File data, mapped read-only
 i64 file_size = 0; // File size
+i64 file_map_size = 0; // Size of the mapping of the file data, which ends with at least one byte of zeros
 Arena *arena = 0; // Arena for memory allocation
 Array *variables = 0; // Variables
 Array *snippets = 0; // Snippets
 i64 read_position = 0;
 Array *jump_stack = 0; // Jump stack determines what happens when a block ends
 i32 block_level = 0; // Current block level used for variable scope
+Map *literal_sites = 0; // Constant pool index of the number literal starting at a read position, for the positions that have one
+Map *expression_plans = 0; // Compiled expression or condition starting at a read position, for the positions where one ran
+Map *name_sites = 0; // Name starting at a read position, saved the first time it's parsed there
+u32 scope_generation = 1; // Changes whenever a variable is added or removed, which invalidates the variables cached at name sites
+u32 snippet_generation = 1; // Changes whenever a snippet is declared, which invalidates the snippets cached at use sites
+i32 division_precision = 3; // Decimals a division keeps in addition to those of its operands
+u8 division_rounding = 0; // Rounding mode of the last decimal of a division
+char *output_buffer = 0; // Printed text waiting to be written to stdout
+i32 output_length = 0; // Used size of the output buffer
+i32 output_lines = 0; // Lines in the output buffer
 
 const i32 success = 0;
 const i32 error = 1;
 
+// Size of the first block of the arena, which grows as the file needs more
+const i32 ARENA_START_SIZE = 1024 * 1024;
+
+// Printed text is collected and written in large chunks, at the latest when this many lines are waiting
+const i32 OUTPUT_BUFFER_SIZE = 256 * 1024;
+const i32 OUTPUT_FLUSH_LINES = 4096;
+
+// Write the output buffer to stdout
+void flush_output() {
+  fwrite(output_buffer, 1, output_length, stdout);
+  output_length = 0;
+  output_lines = 0;
+}
+
+// Add a number as a line of decimal text to the output buffer
+void print_number(Number number) {
+  if (output_length + NUMBER_TEXT_SIZE + 1 > OUTPUT_BUFFER_SIZE) {
+    flush_output();
+  }
+  output_length += number_format(number, output_buffer + output_length);
+  output_buffer[output_length] = '\n';
+  output_length += 1;
+  output_lines += 1;
+  if (output_lines >= OUTPUT_FLUSH_LINES) {
+    flush_output();
+  }
+}
+
 bool is_token(const char *token) {
   i32 token_length = strlen(token);
   if (read_position + token_length > file_size) return false;
   return memcmp(file_data + read_position, token, token_length) == 0;
 }
 
+// Returns true if a keyword is at the read position and followed by a space or a digit, so names that start with the keyword aren't taken for it
+bool is_keyword(const char *keyword) {
+  i32 keyword_length = strlen(keyword);
+  if (!is_token(keyword) || read_position + keyword_length >= file_size) return false;
+  u8 next = file_data[read_position + keyword_length];
+  return next == ' ' || (next >= '0' && next <= '9');
+}
+
 typedef struct {
   u8 skip_else; // if-else blocks
-  u8 return_to; // while blocks and function calls
+  u8 return_to; // while blocks
+  u8 snippet_return; // snippet bodies
 } JumpTypes;
 
 // Block ends for different block types
 const JumpTypes jumps = {
   .skip_else = 1,
   .return_to = 2,
+  .snippet_return = 3
 };
 
 // Block types for the block stack
@@ -65,12 +125,6 @@ Jump skip_else_jump = {
   .index = 0
 };
 
-// Number struct
-typedef struct {
-  i64 value;
-  i16 exponent;
-} Number;
-
 // Variable struct
 typedef struct {
   Number value;
@@ -78,12 +132,32 @@ typedef struct {
   i32 level;
 } Variable;
 
+// Name parsed at a read position
+// A variable name also caches the variable it was found as, which stays valid as long as the scope generation doesn't change, and a snippet name caches the snippet start the same way
+typedef struct Name {
+  char *text;
+  i32 length;
+  Variable *variable;
+  u32 generation; // Scope generation the variable was found in
+  i64 snippet_index;
+  u32 snippet_generation; // Snippet generation the snippet was found in
+} Name;
+
 // Snippet struct
 typedef struct {
   char *name;
   i64 index;
 } Snippet;
 
+// Constant struct for parsed number literals
+typedef struct {
+  Number value;
+  i32 length; // Length of the literal in the source
+} Constant;
+
+Constant *constant_pool = 0; // Number literals parsed at load time
+i32 constant_count = 0;
+
 typedef struct {
   u8 plus;
   u8 minus;
@@ -114,31 +188,147 @@ const Comparators comparators = {
   .greater_than_or_equal_to = 5
 };
 
-// Parse a number
-Number parse_number() {
-  Number number = {0};
-  // Check if the number is negative
-  bool negative = file_data[read_position] == '-';
-  read_position += negative ? 1 : 0;
-
-  bool decimal = false;
-  while ((file_data[read_position] >= '0' && file_data[read_position] <= '9') || file_data[read_position] == '.') {
-    if (file_data[read_position] == '.') {
-      decimal = true;
+typedef struct {
+  u8 unseen;
+  u8 integer;
+  u8 decimal;
+} Shapes;
+
+// Operand shapes recorded at arithmetic and comparison sites
+const Shapes shapes = {
+  .unseen = 0,
+  .integer = 1, // only exponent 0 operands seen so far
+  .decimal = 2 // a decimal operand has been seen, the site stays on the general path
+};
+
+// Returns the read position of the first number literal at or after a position, or the file size if there is none
+// Digits in comments and digits that continue a name are not literals
+i64 next_literal(i64 position) {
+  while (position < file_size) {
+    u8 character = file_data[position];
+    if (character >= '0' && character <= '9') {
+      return position;
+    } else if (character == '/' && position + 1 < file_size && file_data[position + 1] == '/') {
+      while (position < file_size && file_data[position] != '\n') {
+        position += 1;
+      }
+    } else if ((character >= 'a' && character <= 'z') || character == '_') {
+      position += 1;
+      while (position < file_size && ((file_data[position] >= 'a' && file_data[position] <= 'z') || file_data[position] == '_' ||
+             (file_data[position] >= '0' && file_data[position] <= '9'))) {
+        position += 1;
+      }
     } else {
-      number.value = number.value * 10 + file_data[read_position] - '0';
-      if (decimal) {
-        number.exponent -= 1;
+      position += 1;
+    }
+  }
+  return file_size;
+}
+
+// Number literal found while loading, with its read position
+typedef struct {
+  i64 position;
+  Constant constant;
+} Literal;
+
+// Parses all number literals in the file once and adds them to the constant pool
+// Equal literals share one pool entry, found through a hash table that is only used while loading
+void load_constants() {
+  // Parse the literals into a list first, so the tables are sized by the number of literals and not by the size of the file
+  i32 literal_count = 0;
+  i32 literal_capacity = 1024;
+  Literal *literals = malloc(literal_capacity * sizeof(Literal));
+  if (literals == NULL) {
+    printf("Memory allocation failed in load_constants\n");
+    exit(1);
+  }
+  for (i64 position = next_literal(0); position < file_size; position = next_literal(position)) {
+    if (literal_count == literal_capacity) {
+      literal_capacity *= 2;
+      literals = realloc(literals, literal_capacity * sizeof(Literal));
+      if (literals == NULL) {
+        printf("Memory allocation failed in load_constants\n");
+        exit(1);
       }
     }
-    read_position += 1;
+    Literal *literal = &literals[literal_count];
+    literal->position = position;
+    literal->constant.value = (Number){.value = 0, .exponent = 0};
+    literal->constant.length = (i32)number_parse(file_data + position, file_size - position, &literal->constant.value);
+    literal_count += 1;
+    position += literal->constant.length;
+  }
+
+  // The table is at most half full even if every literal is different
+  i64 table_size = 16;
+  while (table_size < (i64)literal_count * 2) {
+    table_size *= 2;
   }
-  if (negative) {
-    number.value = -number.value;
+  i32 *table = malloc(table_size * sizeof(i32));
+  Constant *constants = malloc((literal_count + 1) * sizeof(Constant));
+  literal_sites = map_create(arena, sizeof(i32), literal_count);
+  if (table == NULL || constants == NULL || literal_sites == 0) {
+    printf("Memory allocation failed in load_constants\n");
+    exit(1);
   }
-  return number;
+  for (i64 i = 0; i < table_size; i++) {
+    table[i] = INVALID_ARRAY_INDEX;
+  }
+  constant_count = 0;
+  for (i32 i = 0; i < literal_count; i++) {
+    Constant constant = literals[i].constant;
+    u64 hash = ((u64)constant.value.value * 0x9E3779B97F4A7C15u) ^ ((u64)(u16)constant.value.exponent << 8) ^ (u64)constant.length;
+    i64 slot = (hash >> 17) & (table_size - 1);
+    while (table[slot] != INVALID_ARRAY_INDEX) {
+      Constant *existing = &constants[table[slot]];
+      if (existing->value.value == constant.value.value && existing->value.exponent == constant.value.exponent && existing->length == constant.length) {
+        break;
+      }
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (table[slot] == INVALID_ARRAY_INDEX) {
+      table[slot] = constant_count;
+      constants[constant_count] = constant;
+      constant_count += 1;
+    }
+    i32 *site = (i32 *)map_put(literal_sites, literals[i].position);
+    if (site == 0) {
+      printf("Memory allocation failed in load_constants\n");
+      exit(1);
+    }
+    *site = table[slot];
+  }
+  free(table);
+  free(literals);
+
+  // Copy the pool to the arena, without the room for literals that turned out to be equal
+  constant_pool = (Constant *)arena_fill(arena, (constant_count + 1) * sizeof(Constant));
+  if (constant_pool == 0) {
+    printf("Memory allocation failed in load_constants\n");
+    exit(1);
+  }
+  memcpy(constant_pool, constants, constant_count * sizeof(Constant));
+  free(constants);
 }
 
+// Returns the constant pool index of the number literal starting at a read position, or INVALID_ARRAY_INDEX if there is none
+i32 literal_site(i64 position) {
+  i32 *site = (i32 *)map_get(literal_sites, position);
+  return site == 0 ? INVALID_ARRAY_INDEX : *site;
+}
+
+// Parse a number
+// Literals found at load time are taken from the constant pool
+Number parse_number() {
+  i32 constant_index = literal_site(read_position);
+  if (constant_index != INVALID_ARRAY_INDEX) {
+    read_position += constant_pool[constant_index].length;
+    return constant_pool[constant_index].value;
+  }
+  Number number = {.value = 0, .exponent = 0};
+  read_position += number_parse(file_data + read_position, file_size - read_position, &number);
+  return number;
+}
 
 // Step into the next block
 i64 enter_block() {
@@ -178,6 +368,12 @@ void skip_spaces() {
   }
 }
 
+// Returns true if the statement at the read position runs only once, which is the case outside of blocks and snippets
+// Nothing is saved for such statements, as the interpreter never reads them again
+bool runs_once() {
+  return array_length(jump_stack) == 0;
+}
+
 // Prune the variables array by removing all variables at the current block level and then decrease the block level
 void decrese_block_level() {
   i32 index = array_last(variables);
@@ -186,6 +382,7 @@ void decrese_block_level() {
     Variable *variable = (Variable *)array_get(variables, index);
     if (variable->level == block_level) {
       array_pop(variables);
+      scope_generation += 1;
     } else {
       same_level = false;
     }
@@ -207,9 +404,17 @@ i32 get_variable_index(char *name) {
   return -1;
 }
 
-// Parses out a variable name and saves it either in the arena or on the heap
-char *parse_name(bool save){
+// Parses out a variable name
+// Names are saved in the arena the first time they are parsed at a read position and reused after that, unless they only run once
+Name *parse_name() {
   skip_spaces();
+  i64 name_site = read_position;
+  bool save = !runs_once();
+  Name **site = save ? (Name **)map_get(name_sites, name_site) : 0;
+  if (site != 0) {
+    read_position += (*site)->length;
+    return *site;
+  }
   u8 *name_start = &file_data[read_position];
   i32 name_length = 0;
   while ((file_data[read_position] >= 'a' && file_data[read_position] <= 'z') || file_data[read_position] == '_') {
@@ -217,35 +422,47 @@ char *parse_name(bool save){
     read_position += 1;
   }
   // Allocate memory for the variable name and copy it
-  char *variable_name = 0;
-  if (save) {
-    variable_name = arena_fill(arena, sizeof(char) * (name_length + 1));
-  } else {
-    variable_name = malloc(sizeof(char) * (name_length + 1));
+  Name *name = (Name *)arena_fill(arena, sizeof(Name));
+  if (name == 0) {
+    printf("Memory allocation failed in parse_name\n");
+    exit(1);
+  }
+  name->text = arena_fill(arena, sizeof(char) * (name_length + 1));
+  if (name->text == 0) {
+    printf("Memory allocation failed in parse_name\n");
+    exit(1);
   }
-  if (variable_name == NULL) {
-    printf("Memory allocation failed in parse_get_variable\n");
+  memcpy(name->text, name_start, name_length);
+  name->text[name_length] = '\0'; // Null terminate the string
+  name->length = name_length;
+  name->variable = 0;
+  name->generation = 0;
+  name->snippet_index = -1;
+  name->snippet_generation = 0;
+  if (!save) return name;
+  site = (Name **)map_put(name_sites, name_site);
+  if (site == 0) {
+    printf("Memory allocation failed in parse_name\n");
     exit(1);
   }
-  memcpy(variable_name, name_start, name_length);
-  variable_name[name_length] = '\0'; // Null terminate the string
-  return variable_name;
+  *site = name;
+  return name;
 }
 
-// Parses out a variable name and returns that item from the variables array
-Number parse_get_variable() {
-  char *variable_name = parse_name(false);
-  i32 variable_index = get_variable_index(variable_name);
-  Number variable_value = {0};
-  if (variable_index >= 0) {
-    Variable *variable = (Variable *)array_get(variables, variable_index);
-    variable_value = variable->value;
-  } else {
-    printf("Error: Variable %s not found\n", variable_name);
+// Returns the variable a name refers to, searching the variables array only when the scope changed since the last time
+Variable *find_variable(Name *name) {
+  if (name->generation == scope_generation) {
+    return name->variable;
+  }
+  i32 variable_index = get_variable_index(name->text);
+  if (variable_index < 0) {
+    flush_output();
+    printf("Error: Variable %s not found\n", name->text);
     exit(1);
   }
-  free(variable_name);
-  return variable_value;
+  name->variable = (Variable *)array_get(variables, variable_index);
+  name->generation = scope_generation;
+  return name->variable;
 }
 
 // Get the index of a snippet by name
@@ -261,203 +478,458 @@ i64 get_snippet_index(char *name) {
   return -1;
 }
 
+void skip_elses();
+
+// Returns how many blocks end between the read position and the end of the running snippet, or 0 if anything runs before the snippet ends
+// Only spaces, comments, } and else blocks that are skipped after an if block may come in between
+i32 count_tail_blocks() {
+  i64 start = read_position;
+  i32 jump_index = array_last(jump_stack);
+  i32 blocks = 0;
+  while (jump_index >= 0) {
+    while (is_token(" ") || is_token("\n")) {
+      read_position += 1;
+    }
+    if (is_token("//")) {
+      skip_line();
+      continue;
+    }
+    if (!is_token("}")) break;
+    read_position += 1;
+    blocks += 1;
+    Jump *jump = (Jump *)array_get(jump_stack, jump_index);
+    if (jump->type == jumps.snippet_return) {
+      read_position = start;
+      return blocks;
+    }
+    // The end of a while block runs the loop again
+    if (jump->type != jumps.skip_else) break;
+    skip_spaces();
+    skip_elses();
+    jump_index -= 1;
+  }
+  read_position = start;
+  return 0;
+}
+
+// Ends the given number of blocks up to the running snippet body, which is then reused by the snippet that replaces it
+// The variables of the ended blocks stay in the snippet body, except the ones declared again later, which can't be found by name anymore
+void reuse_snippet_frame(i32 blocks) {
+  for (i32 i = 1; i < blocks; i++) {
+    array_pop(jump_stack);
+  }
+  block_level -= blocks - 1;
+  i32 first = array_length(variables);
+  while (first > 0 && ((Variable *)array_get(variables, first - 1))->level >= block_level) {
+    first -= 1;
+  }
+  i32 last = array_last(variables);
+  i32 kept = first;
+  for (i32 i = first; i <= last; i++) {
+    Variable variable = *(Variable *)array_get(variables, i);
+    bool shadowed = false;
+    for (i32 j = i + 1; j <= last && !shadowed; j++) {
+      shadowed = strcmp(((Variable *)array_get(variables, j))->name, variable.name) == 0;
+    }
+    if (!shadowed) {
+      variable.level = block_level;
+      array_set(variables, kept, &variable);
+      kept += 1;
+    }
+  }
+  while (array_length(variables) > kept) {
+    array_pop(variables);
+  }
+  scope_generation += 1;
+}
+
 // Parses out a snippet name and sets that item's index from the snippets array
+// A use that ends the running snippet replaces it instead of returning to it, so snippets that end by using each other run in constant memory
 void parse_get_snippet() {
-  char *snippet_name = parse_name(false);
-  i64 snippet_index = get_snippet_index(snippet_name);
+  Name *snippet_name = parse_name();
+  if (snippet_name->snippet_generation != snippet_generation) {
+    snippet_name->snippet_index = get_snippet_index(snippet_name->text);
+    snippet_name->snippet_generation = snippet_generation;
+  }
+  i64 snippet_index = snippet_name->snippet_index;
   if (snippet_index == -1) {
-    printf("Error: Snippet %s not found\n", snippet_name);
+    flush_output();
+    printf("Error: Snippet %s not found\n", snippet_name->text);
     exit(1);
   }
-  // Put end of the line on the jump stack so the parser knows where to continue after the snippet
   skip_line();
-  Jump return_jump = {
-    .type = jumps.return_to,
-    .index = read_position
-  };
-  array_push(jump_stack, &return_jump);
+  i32 tail_blocks = count_tail_blocks();
+  if (tail_blocks > 0) {
+    reuse_snippet_frame(tail_blocks);
+  } else {
+    // Put end of the line on the jump stack so the parser knows where to continue after the snippet
+    Jump return_jump = {
+      .type = jumps.snippet_return,
+      .index = read_position
+    };
+    array_push(jump_stack, &return_jump);
+    block_level += 1;
+  }
   // Set the read position to the snippet start
   read_position = snippet_index;
-  block_level += 1;
-  free(snippet_name);
 }
 
-// Takes two numbers and aligns them at the lowest exponent
-void align_exponents(Number *a, Number *b) {
-  if (a->exponent < b->exponent) {
-    b->value *= pow(10, b->exponent - a->exponent);
-    b->exponent = a->exponent;
-  } else if (a->exponent > b->exponent) {
-    a->value *= pow(10, a->exponent - b->exponent);
-    a->exponent = b->exponent;
+// Records the shape of two operands at a site and returns true if the site has only seen integers before
+bool integer_site(u8 *shape, Number *a, Number *b) {
+  bool integers = (a->exponent | b->exponent) == 0;
+  if (*shape == shapes.integer && integers) {
+    return true;
   }
+  *shape = integers && *shape != shapes.decimal ? shapes.integer : shapes.decimal;
+  return false;
 }
 
-// Takes a number and adds a number of decimals to it
-void add_decimals(Number *number, i32 decimals) {
-  number->value *= pow(10, decimals);
-  number->exponent -= decimals;
+// Runs an operator on two numbers
+// Sites that have only seen integers skip the exponent alignment
+Number calculate(u8 op_code, u8 *shape, Number a, Number b) {
+  if (op_code == operators.divide) {
+    return number_divide(a, b, division_precision, division_rounding);
+  }
+  if (integer_site(shape, &a, &b)) {
+    if (op_code == operators.plus) {
+      a.value = (i64)((u64)a.value + (u64)b.value);
+      return a;
+    } else if (op_code == operators.minus) {
+      a.value = (i64)((u64)a.value - (u64)b.value);
+      return a;
+    } else if (op_code == operators.multiply) {
+      a.value = (i64)((u64)a.value * (u64)b.value);
+      return a;
+    }
+  }
+  if (op_code == operators.plus) {
+    return number_add(a, b);
+  } else if (op_code == operators.minus) {
+    return number_subtract(a, b);
+  } else if (op_code == operators.multiply) {
+    return number_multiply(a, b);
+  }
+  return a;
+}
+
+typedef struct {
+  u8 constant;
+  u8 variable;
+  u8 negate;
+  u8 operation;
+  u8 compare;
+} StepKinds;
+
+const StepKinds step_kinds = {
+  .constant = 1, // push a number
+  .variable = 2, // push the value of a variable
+  .negate = 3, // negate the top number
+  .operation = 4, // replace the top two numbers with the result of an operator
+  .compare = 5 // replace the top two numbers with 1 if the comparator holds for them and 0 if not
+};
+
+// One step of a compiled expression
+typedef struct {
+  u8 kind;
+  u8 op_code; // Operator of an operation, or comparator of a comparison
+  u8 shape; // Operand shapes seen by an operation or comparison
+  Number value; // Number of a constant
+  Name *name; // Name of a variable
+} Step;
+
+// Expression or condition compiled to postfix steps, with the read position where it ends
+typedef struct Plan {
+  Step *steps;
+  i32 length;
+  i32 depth; // Most numbers on the stack at once
+  i64 end;
+} Plan;
+
+Array *plan_steps = 0; // Steps of the expression being compiled
+i32 plan_depth = 0; // Numbers on the stack after the steps compiled so far
+i32 plan_max_depth = 0;
+Plan scratch_plan; // Plan of the last expression that runs only once
+Step *scratch_steps = 0; // Steps of the scratch plan
+i32 scratch_capacity = 0;
+Number *evaluation_stack = 0; // Stack of numbers used to run plans
+i32 evaluation_stack_size = 0;
+
+void expression_error(const char *message) {
+  flush_output();
+  printf("Error: %s in expression\n", message);
+  exit(1);
 }
 
-Number divide_numbers(Number *a, Number *b) {
-  Number result = {.value = 0, .exponent = 0};
-  if (b->value != 0) {
-    // Add 3 decimals
-    add_decimals(a, 3 + abs(a->exponent));
-    result.value = a->value / b->value;
-    result.exponent = a->exponent - b->exponent;
+bool at_expression_end() {
+  return is_token(")") || is_token(";") || is_token("<") || is_token(">") || is_token("=") || read_position >= file_size;
+}
+
+// Returns the operator at the read position, or 0 if there is none
+u8 operator_at() {
+  if (is_token("+")) {
+    return operators.plus;
+  } else if (is_token("-")) {
+    return operators.minus;
+  } else if (is_token("*")) {
+    return operators.multiply;
+  } else if (is_token("/")) {
+    return operators.divide;
   }
-  return result;
+  return 0;
 }
 
-// Compacts a number by removing trailing zeros
-Number compact_number(Number number) {
-  Number result = number;
-  while (result.value % 10 == 0 && result.value != 0) {
-    result.value /= 10;
-    result.exponent += 1;
+// Multiplication and division bind tighter than addition and subtraction
+u8 operator_precedence(u8 op_code) {
+  return op_code == operators.multiply || op_code == operators.divide ? 2 : 1;
+}
+
+void add_step(Step step) {
+  array_push(plan_steps, &step);
+  if (step.kind == step_kinds.constant || step.kind == step_kinds.variable) {
+    plan_depth += 1;
+  } else if (step.kind == step_kinds.operation) {
+    plan_depth -= 1;
+  }
+  if (plan_depth > plan_max_depth) {
+    plan_max_depth = plan_depth;
   }
-  return result;
 }
 
-// Evaluate an expression
-// Parser reads up to 3 numbers and 2 operators at a time and evaluates the operator with the highest priority first. This makes it possible to evaluate expressions like a + b * c * d + e accurately.
-Number evaluate_expression() {
-  Number result = {.value = 0, .exponent = 0};
-  u8 parsed_numbers = 0; // Keep track of current parser window
-  Number first_number = {.value = 0, .exponent = 0};
-  Number second_number = {.value = 0, .exponent = 0};
-  Number third_number = {.value = 0, .exponent = 0}; // For the case of a + b * c, we want to wait with the addition until we know the result of the multiplication
-  u8 op_code = 0; // 1 = plus, 2 = minus, 3 = multiply, 4 = divide
-  u8 op_code2 = 0;
-  while (!is_token(")") && !is_token(";") && !is_token("<") && !is_token(">") && !is_token("=") && read_position < file_size) {
-    while (is_token(" ")) {
-      read_position += 1;
+void compile_operation(u8 min_precedence);
+
+// Compiles a number, a variable, a parenthesized expression or a negated operand
+void compile_operand() {
+  skip_spaces();
+  Step step = {.kind = 0, .op_code = 0, .shape = shapes.unseen, .value = {.value = 0, .exponent = 0}, .name = 0};
+  if (is_token("-")) {
+    read_position += 1;
+    compile_operand();
+    // A negative number is a constant of its own
+    Step *last = (Step *)array_get(plan_steps, array_last(plan_steps));
+    if (last->kind == step_kinds.constant) {
+      last->value.value = (i64)(0 - (u64)last->value.value);
+    } else {
+      step.kind = step_kinds.negate;
+      add_step(step);
     }
-    // If operator
-    if (is_token("+")) {
-      read_position += 1;
-      op_code = op_code == 0 ? operators.plus : op_code;
-      op_code2 = op_code > 0 ? operators.plus : 0;
-    } else if (is_token("-")) {
-      read_position += 1;
-      op_code = op_code == 0 ? operators.minus : op_code;
-      op_code2 = op_code > 0 ? operators.minus : 0;
-    } else if (is_token("*")) {
-      read_position += 1;
-      op_code = op_code == 0 ? operators.multiply : op_code;
-      op_code2 = op_code > 0 ? operators.multiply : 0;
-    } else if (is_token("/")) {
-      read_position += 1;
-      op_code = op_code == 0 ? operators.divide : op_code;
-      op_code2 = op_code > 0 ? operators.divide : 0;
-    } else if (file_data[read_position] >= '0' && file_data[read_position] <= '9') {
-      Number number = parse_number();
-      if (parsed_numbers == 0) {
-        first_number = number;
-        parsed_numbers += 1;
-      } else if (parsed_numbers == 1) {
-        second_number = number;
-        parsed_numbers += 1;
-      } else {
-        third_number = number;
-        parsed_numbers += 1;
-      }
+  } else if (is_token("+")) {
+    read_position += 1;
+    compile_operand();
+  } else if (read_position < file_size && file_data[read_position] >= '0' && file_data[read_position] <= '9') {
+    step.kind = step_kinds.constant;
+    step.value = parse_number();
+    add_step(step);
+  } else if (read_position < file_size && file_data[read_position] >= 'a' && file_data[read_position] <= 'z') {
+    step.kind = step_kinds.variable;
+    step.name = parse_name();
+    add_step(step);
+  } else if (is_token("(")) {
+    read_position += 1;
+    compile_operation(1);
+    skip_spaces();
+    if (!is_token(")")) {
+      expression_error("Missing )");
     }
-    // if variable name
-    else if (file_data[read_position] >= 'a' && file_data[read_position] <= 'z') {
-      Number variable = parse_get_variable();
-      if (parsed_numbers == 0) {
-        first_number = variable;
-        parsed_numbers += 1;
-      } else if (parsed_numbers == 1) {
-        second_number = variable;
-        parsed_numbers += 1;
-      } else {
-        third_number = variable;
-        parsed_numbers += 1;
-      }
+    read_position += 1;
+  } else {
+    expression_error("Missing number");
+  }
+}
+
+// Compiles an operand followed by all operators of at least min_precedence, so that operators of equal precedence run from left to right
+void compile_operation(u8 min_precedence) {
+  compile_operand();
+  while (true) {
+    skip_spaces();
+    u8 op_code = operator_at();
+    if (op_code == 0 || operator_precedence(op_code) < min_precedence) {
+      return;
     }
-    // if new block
-    else if (is_token("(")) {
-      read_position += 1;
-      Number block_result = evaluate_expression();
-      read_position += 1;
-      if (parsed_numbers == 0) {
-        first_number = block_result;
-        parsed_numbers += 1;
-      } else if (parsed_numbers == 1) {
-        second_number = block_result;
-        parsed_numbers += 1;
-      } else {
-        third_number = block_result;
-        parsed_numbers += 1;
-      }
-    } else {
-      // printf("Unknown token in eval\n");
+    Step step = {.kind = step_kinds.operation, .op_code = op_code, .shape = shapes.unseen, .value = {.value = 0, .exponent = 0}, .name = 0};
+    read_position += 1;
+    compile_operation(operator_precedence(op_code) + 1);
+    add_step(step);
+  }
+}
+
+// Compiles one side of a condition or a whole expression into the plan steps
+// An empty expression has the value 0
+void compile_side() {
+  skip_spaces();
+  if (at_expression_end()) {
+    add_step((Step){.kind = step_kinds.constant, .op_code = 0, .shape = shapes.unseen, .value = {.value = 0, .exponent = 0}, .name = 0});
+    return;
+  }
+  compile_operation(1);
+  skip_spaces();
+  if (!at_expression_end()) {
+    expression_error("Missing operator");
+  }
+}
+
+void start_plan() {
+  array_clear(plan_steps);
+  plan_depth = 0;
+  plan_max_depth = 0;
+}
+
+// Copies the compiled steps to a plan that ends at the read position
+// A plan that isn't saved goes to the scratch plan, which the next unsaved plan overwrites
+Plan *finish_plan(bool save) {
+  Plan *plan = save ? (Plan *)arena_fill(arena, sizeof(Plan)) : &scratch_plan;
+  if (plan == 0) {
+    printf("Memory allocation failed in finish_plan\n");
+    exit(1);
+  }
+  plan->length = array_length(plan_steps);
+  plan->depth = plan_max_depth;
+  plan->end = read_position;
+  if (save) {
+    plan->steps = (Step *)arena_fill(arena, plan->length * sizeof(Step));
+  } else {
+    if (plan->length > scratch_capacity) {
+      scratch_capacity = plan->length * 2;
+      scratch_steps = (Step *)realloc(scratch_steps, scratch_capacity * sizeof(Step));
     }
-    // Run calculation if we have three numbers, to make room for the next number
-    if (parsed_numbers == 3) {
-      // If second operator has higher priority, run it first
-      if (op_code2 == operators.multiply || op_code2 == operators.divide) {
-        align_exponents(&second_number, &third_number);
-        if (op_code2 == operators.multiply) {
-          second_number.value *= third_number.value;
-          second_number.exponent += third_number.exponent;
-        } else if (op_code2 == operators.divide) {
-          second_number = divide_numbers(&second_number, &third_number);
-        }
-      }
-      // Run only the first operator and move the third operator
-      else {
-        align_exponents(&first_number, &second_number);
-        if (op_code == operators.plus) {
-          first_number.value += second_number.value;
-        } else if (op_code == operators.minus) {
-          first_number.value -= second_number.value;
-        } else if (op_code == operators.multiply) {
-          first_number.value *= second_number.value;
-          first_number.exponent += second_number.exponent;
-        } else if (op_code == operators.divide) {
-          first_number = divide_numbers(&first_number, &second_number);
-        }
-        // Move third number to second number slot
-        second_number = third_number;
-        op_code = op_code2;
-      }
-      // Reset third number
-      third_number = (Number){.value = 0, .exponent = 0};
-      op_code2 = 0;
-      parsed_numbers = 2;
+    plan->steps = scratch_steps;
+  }
+  if (plan->steps == 0 && plan->length > 0) {
+    printf("Memory allocation failed in finish_plan\n");
+    exit(1);
+  }
+  for (i32 i = 0; i < plan->length; i++) {
+    plan->steps[i] = *(Step *)array_get(plan_steps, i);
+  }
+  if (plan->depth > evaluation_stack_size) {
+    evaluation_stack_size = plan->depth;
+    evaluation_stack = (Number *)arena_fill(arena, evaluation_stack_size * sizeof(Number));
+    if (evaluation_stack == 0) {
+      printf("Memory allocation failed in finish_plan\n");
+      exit(1);
     }
-  } // end while - has reached end of expression
-  // If there are two numbers, run the operator
-  if (parsed_numbers == 2) {
-    align_exponents(&first_number, &second_number);
-    if (op_code == operators.plus) {
-      result.value = first_number.value + second_number.value;
-    } else if (op_code == operators.minus) {
-      result.value = first_number.value - second_number.value;
-    } else if (op_code == operators.multiply) {
-      result.value = first_number.value * second_number.value;
-      first_number.exponent += second_number.exponent;
-    } else if (op_code == operators.divide) {
-      result = divide_numbers(&first_number, &second_number);
-      first_number.exponent = result.exponent;
+  }
+  return plan;
+}
+
+// Saves the plan of the expression or condition starting at a read position
+void save_plan(i64 position, Plan *plan) {
+  Plan **saved = (Plan **)map_put(expression_plans, position);
+  if (saved == 0) {
+    printf("Memory allocation failed in save_plan\n");
+    exit(1);
+  }
+  *saved = plan;
+}
+
+// Returns the plan of the expression or condition starting at a read position, or 0 if it hasn't run yet
+Plan *saved_plan(i64 position) {
+  Plan **saved = (Plan **)map_get(expression_plans, position);
+  return saved == 0 ? 0 : *saved;
+}
+
+// Compiles the expression at the read position into a plan, leaving the read position at its end, and keeps the plan in the arena if save is set
+Plan *compile_expression(bool save) {
+  start_plan();
+  compile_side();
+  return finish_plan(save);
+}
+
+// Compiles the condition at the read position into a plan that ends with the comparison
+// A condition without a comparator is false
+Plan *compile_condition() {
+  start_plan();
+  compile_side();
+  skip_spaces();
+  Step step = {.kind = step_kinds.compare, .op_code = 0, .shape = shapes.unseen, .value = {.value = 0, .exponent = 0}, .name = 0};
+  if (is_token("==")) {
+    step.op_code = comparators.equal_to;
+    read_position += 2;
+  } else if (is_token("<=")) {
+    step.op_code = comparators.less_than_or_equal_to;
+    read_position += 2;
+  } else if (is_token("<")) {
+    step.op_code = comparators.less_than;
+    read_position += 1;
+  } else if (is_token(">=")) {
+    step.op_code = comparators.greater_than_or_equal_to;
+    read_position += 2;
+  } else if (is_token(">")) {
+    step.op_code = comparators.greater_than;
+    read_position += 1;
+  }
+  skip_spaces();
+  compile_side();
+  add_step(step);
+  return finish_plan(true);
+}
+
+// Compares two numbers
+// Sites that have only seen integers skip the exponent alignment
+bool compare(u8 comparator, u8 *shape, Number a, Number b) {
+  if (!integer_site(shape, &a, &b)) {
+    number_align(&a, &b);
+  }
+  if (comparator == comparators.equal_to) {
+    return a.value == b.value;
+  } else if (comparator == comparators.less_than) {
+    return a.value < b.value;
+  } else if (comparator == comparators.greater_than) {
+    return a.value > b.value;
+  } else if (comparator == comparators.less_than_or_equal_to) {
+    return a.value <= b.value;
+  } else if (comparator == comparators.greater_than_or_equal_to) {
+    return a.value >= b.value;
+  }
+  return false;
+}
+
+// Runs the steps of a plan on the evaluation stack
+Number run_plan(Plan *plan) {
+  Number *stack = evaluation_stack;
+  i32 top = 0;
+  Step *step = plan->steps;
+  Step *last = plan->steps + plan->length;
+  for (; step < last; step++) {
+    if (step->kind == step_kinds.operation) {
+      top -= 1;
+      stack[top - 1] = calculate(step->op_code, &step->shape, stack[top - 1], stack[top]);
+    } else if (step->kind == step_kinds.constant) {
+      stack[top] = step->value;
+      top += 1;
+    } else if (step->kind == step_kinds.variable) {
+      stack[top] = find_variable(step->name)->value;
+      top += 1;
+    } else if (step->kind == step_kinds.compare) {
+      top -= 1;
+      bool result = compare(step->op_code, &step->shape, number_compact(stack[top - 1]), number_compact(stack[top]));
+      stack[top - 1] = (Number){.value = result, .exponent = 0};
+    } else {
+      stack[top - 1].value = (i64)(0 - (u64)stack[top - 1].value);
     }
-    result.exponent = first_number.exponent;
   }
-  // If there is only one number, return it
-  else if (parsed_numbers == 1) {
-    result = first_number;
+  return number_compact(stack[0]);
+}
+
+// Evaluate an expression
+// Each expression is compiled to a plan the first time it runs, so running it again skips reading the text and continues at the end of the expression
+// An expression that only runs once isn't saved
+Number evaluate_expression() {
+  bool save = !runs_once();
+  Plan *plan = save ? saved_plan(read_position) : 0;
+  if (plan == 0) {
+    i64 start = read_position;
+    plan = compile_expression(save);
+    if (save) {
+      save_plan(start, plan);
+    }
   }
-  result = compact_number(result);
-  return result;
+  read_position = plan->end;
+  return run_plan(plan);
 }
 
 // Parses out a variable name and a value and adds them as a new new item to the variables array
 i64 new_variable() {
-  char *variable_name = parse_name(true);
+  Name *variable_name = parse_name();
   // Skip spaces and =
   while (is_token(" ") || is_token("=")) {
     read_position += 1;
@@ -469,23 +941,25 @@ i64 new_variable() {
   // Push the variable to the variables array
   Variable new_variable = {
     .value = value,
-    .name = variable_name,
+    .name = variable_name->text,
     .level = block_level
   };
   array_push(variables, &new_variable);
+  scope_generation += 1;
   return success;
 }
 
 // Parses out a snippet name and adds it to the snippets array
 i64 new_snippet() {
-  char *snippet_name = parse_name(true);
+  Name *snippet_name = parse_name();
   enter_block();
   // Push the snippet to the snippets array
   Snippet new_snippet = {
-    .name = snippet_name,
+    .name = snippet_name->text,
     .index = read_position
   };
   array_push(snippets, &new_snippet);
+  snippet_generation += 1;
   // Snippet should not be evaluated before it's inserted
   skip_block();
   return success;
@@ -493,27 +967,50 @@ i64 new_snippet() {
 
 // Parses out a variable name, finds it in the variables array and updates it with a new value
 i64 set_variable() {
-  char *variable_name = parse_name(false);
-  i32 variable_index = get_variable_index(variable_name);
-  if (variable_index >= 0) {
-    Variable *variable_ref = (Variable *)array_get(variables, variable_index);
+  Variable *variable_ref = find_variable(parse_name());
+  // Skip spaces and =
+  while (is_token(" ") || is_token("=")) {
+    read_position += 1;
+  }
+  // Get the value
+  Number new_value = evaluate_expression();
+  read_position += 1; // Skip the trailing ;
+  variable_ref->value = new_value;
+  return success;
+}
 
-    // Skip spaces and =
-    while (is_token(" ") || is_token("=")) {
-      read_position += 1;
-    }
-    // Get the value
-    Number new_value = evaluate_expression();
-    read_position += 1; // Skip the trailing ;
-    variable_ref->value = new_value;
-  } else {
-    printf("Error: Variable %s not found\n", variable_name);
+
+// Parses out the number of decimals divisions should keep
+i64 set_precision() {
+  skip_spaces();
+  Number precision = parse_number();
+  if (precision.exponent != 0 || precision.value < 0 || precision.value > MAX_DIVISION_PRECISION) {
+    flush_output();
+    printf("Error: Precision must be a whole number from 0 to %d\n", MAX_DIVISION_PRECISION);
     exit(1);
   }
-  free(variable_name);
+  division_precision = (i32)precision.value;
+  skip_line();
   return success;
 }
 
+// Parses out the name of the rounding mode divisions should use
+i64 set_rounding() {
+  char *mode_name = parse_name()->text;
+  if (strcmp(mode_name, "truncate") == 0) {
+    division_rounding = rounding_modes.truncate;
+  } else if (strcmp(mode_name, "half_up") == 0) {
+    division_rounding = rounding_modes.half_up;
+  } else if (strcmp(mode_name, "half_even") == 0) {
+    division_rounding = rounding_modes.half_even;
+  } else {
+    flush_output();
+    printf("Error: Rounding %s not found\n", mode_name);
+    exit(1);
+  }
+  skip_line();
+  return success;
+}
 
 // Skips following else blocks after an if or else if block
 void skip_elses() {
@@ -525,47 +1022,21 @@ void skip_elses() {
   }
 }
 
+// Evaluates a condition, which is compiled to a plan the first time it runs like an expression
+// Conditions are always saved, since the condition of a while outside of blocks is evaluated again after the jump of its block is gone
 bool evaluate_condition() {
-  Number first_number = evaluate_expression();
-  skip_spaces();
-  // Get the operator
-  u8 comparator = 0;
-  if (is_token("==")) {
-    comparator = comparators.equal_to;
-    read_position += 2;
-  } else if (is_token("<=")) {
-    comparator = comparators.less_than_or_equal_to;
-    read_position += 2;
-  } else if (is_token("<")) {
-    comparator = comparators.less_than;
-    read_position += 1;
-  } else if (is_token(">=")) {
-    comparator = comparators.greater_than_or_equal_to;
-    read_position += 2;
-  } else if (is_token(">")) {
-    comparator = comparators.greater_than;
-    read_position += 1;
+  Plan *plan = saved_plan(read_position);
+  if (plan == 0) {
+    i64 start = read_position;
+    plan = compile_condition();
+    save_plan(start, plan);
   }
-  skip_spaces();
-  Number second_number = evaluate_expression();
-  align_exponents(&first_number, &second_number);
-
-  // Compare the numbers
-  bool result = false;
-  if (comparator == comparators.equal_to) {
-    result = first_number.value == second_number.value;
-  } else if (comparator == comparators.less_than) {
-    result = first_number.value < second_number.value;
-  } else if (comparator == comparators.greater_than) {
-    result = first_number.value > second_number.value;
-  } else if (comparator == comparators.less_than_or_equal_to) {
-    result = first_number.value <= second_number.value;
-  } else if (comparator == comparators.greater_than_or_equal_to) {
-    result = first_number.value >= second_number.value;
-  }
-  return result;
+  read_position = plan->end;
+  return run_plan(plan).value != 0;
 }
 
+bool tier_run(); // Runs a hot while or use statement in the register machine, see tier.c
+
 // Parser function
 i32 parse_token() {
   // Skip spaces
@@ -580,11 +1051,12 @@ i32 parse_token() {
       if (jump->type == jumps.skip_else) {
         skip_spaces();
         skip_elses();
-      } else if (jump->type == jumps.return_to) {
+      } else if (jump->type == jumps.return_to || jump->type == jumps.snippet_return) {
         read_position = jump->index;
       }
     }
   } else if (is_token("while")) {
+    if (tier_run()) return success;
     Jump iteration_jump = {
       .type = jumps.return_to,
       .index = read_position
@@ -626,6 +1098,7 @@ i32 parse_token() {
     }
   } else if (is_token("else")) {
     read_position += 4;
+    array_push(jump_stack, &skip_else_jump);
     enter_block();
     block_level += 1;
   }
@@ -636,6 +1109,7 @@ i32 parse_token() {
   }
   // Insert snippet
   else if(is_token("use")) {
+    if (tier_run()) return success;
     read_position += 3;
     parse_get_snippet();
   }
@@ -652,53 +1126,177 @@ i32 parse_token() {
   else if (is_token("print")) {
     read_position += 6;
     Number result = evaluate_expression();
-    printf("%lld * 10^%d\n", result.value, result.exponent);
+    print_number(result);
     skip_line();
   }
+  // Division settings
+  else if (is_keyword("precision")) {
+    read_position += 9;
+    set_precision();
+  } else if (is_keyword("rounding")) {
+    read_position += 8;
+    set_rounding();
+  }
   // Existing variable
   else if (file_data[read_position] >= 'a' && file_data[read_position] <= 'z') {
     set_variable();
   }
   // Other token
   else {
+    flush_output();
     printf("Unknown token: %c\n", file_data[read_position]);
     read_position += 1;
   }
   return success;
 }
 
-i32 main(i32 arg_count, char *arguments[]) {
-  if (arg_count != 2) {
-    printf("Tarzan wants: %s <filename>\n", arguments[0]);
-    return 1;
-  }
+#include "vm.c" // Program, vm_run, vm_free, vm_report
+#include "compiler.c" // compile_program, compile_region
+#include "tier.c" // tier_start, tier_run, tier_free
+#include "transpile.c" // transpile_program
+#include "cache.c" // cache_load, cache_store, cache_close
 
-  FILE *file = fopen(arguments[1], "r");
-  if (file == NULL) {
-    printf("Tarzan can't open file %s\n", arguments[1]);
-    return 1;
+// Sets up the tables the interpreter and the compiler keep for the read positions that need them, and the constants of the file
+void start_interpreter() {
+  expression_plans = map_create(arena, sizeof(Plan *), 0);
+  if (expression_plans == 0) {
+    printf("Memory allocation failed in start_interpreter\n");
+    exit(1);
   }
-
-  i32 time_start = clock();
-  // Copy the file into memory
-  fseek(file, 0, SEEK_END);
-  file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  arena = arena_open(file_size);
-  file_data = (u8 *)arena_fill(arena, file_size);
-  fread(file_data, 1, file_size, file);
+  plan_steps = array_create(arena, sizeof(Step));
+  name_sites = map_create(arena, sizeof(Name *), 0);
+  if (name_sites == 0) {
+    printf("Memory allocation failed in start_interpreter\n");
+    exit(1);
+  }
+  load_constants();
 
   // Initialize variables and jump stack arrays
   variables = array_create(arena, sizeof(Variable));
   snippets = array_create(arena, sizeof(Snippet));
   jump_stack = array_create(arena, sizeof(Jump));
+}
 
-  // Parse the file
-  while (read_position < file_size) {
-    parse_token();
+// Maps the file into memory read-only, with zeros after it up to the end of the mapping, returns false if it can't be read
+bool load_file(char *file_name) {
+#ifdef MAP_SOURCE
+  // The text of the file comes straight from the page cache, without a copy, and runs of the same file share it
+  i32 descriptor = open(file_name, O_RDONLY);
+  if (descriptor < 0) return false;
+  struct stat status;
+  if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+    close(descriptor);
+    return false;
   }
-  arena_close(arena);
+  file_size = status.st_size;
+  // A page of zeros is reserved after the text, and the file is mapped over the start of it
+  i64 page_size = sysconf(_SC_PAGESIZE);
+  file_map_size = (file_size / page_size + 1) * page_size;
+  u8 *map = mmap(0, file_map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map != MAP_FAILED && file_size > 0 && mmap(map, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, descriptor, 0) == MAP_FAILED) {
+    munmap(map, file_map_size);
+    map = MAP_FAILED;
+  }
+  close(descriptor);
+  if (map == MAP_FAILED) return false;
+  // The file is read from start to end before anything runs, when its constants are loaded, so all of it is wanted now
+  madvise(map, file_map_size, MADV_WILLNEED);
+  file_data = map;
+  return true;
+#else
+  FILE *file = fopen(file_name, "rb");
+  if (file == NULL) return false;
+  fseek(file, 0, SEEK_END);
+  file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  file_map_size = file_size + 1;
+  file_data = (u8 *)calloc(file_map_size, 1);
+  if (file_data == NULL) {
+    printf("Memory allocation failed in load_file\n");
+    exit(1);
+  }
+  bool read = (i64)fread(file_data, 1, file_size, file) == file_size;
   fclose(file);
+  return read;
+#endif
+}
+
+// Unmaps the file
+void unload_file() {
+#ifdef MAP_SOURCE
+  munmap(file_data, file_map_size);
+#else
+  free(file_data);
+#endif
+  file_data = 0;
+}
+
+i32 main(i32 arg_count, char *arguments[]) {
+  // --interpret runs the file in the interpreter without compiling it, --compile compiles the whole file before it runs and caches the program, see cache.c, and --emit-c writes the compiled file as C to stdout instead of running it
+  bool interpret = arg_count == 3 && strcmp(arguments[1], "--interpret") == 0;
+  bool compile = arg_count == 3 && strcmp(arguments[1], "--compile") == 0;
+  bool emit_c = arg_count == 3 && strcmp(arguments[1], "--emit-c") == 0;
+  if (arg_count != 2 && !interpret && !compile && !emit_c) {
+    printf("Tarzan wants: %s [--interpret | --compile | --emit-c] <filename>\n", arguments[0]);
+    return 1;
+  }
+  char *file_name = arguments[arg_count - 1];
+
+  i32 time_start = clock();
+  if (!load_file(file_name)) {
+    printf("Tarzan can't open file %s\n", file_name);
+    return 1;
+  }
+  // The arena only holds what the file needs while it runs, starting with the output buffer and the tables of the interpreter
+  arena = arena_open(OUTPUT_BUFFER_SIZE + ARENA_START_SIZE);
+  output_buffer = arena == 0 ? 0 : (char *)arena_fill(arena, OUTPUT_BUFFER_SIZE);
+  if (output_buffer == 0) {
+    printf("Memory allocation failed in main\n");
+    unload_file();
+    return 1;
+  }
+
+  // A file compiled by an earlier run is mapped from its cache, and otherwise the interpreter gets its tables
+  Program program = {.code = 0, .length = 0, .register_count = 0, .values = 0, .series = 0, .series_count = 0, .series_terms = 0, .series_term_count = 0, .registers = 0, .jit = 0};
+  bool cached = !interpret && !emit_c && cache_load(&program, file_name);
+  if (!cached) {
+    start_interpreter();
+  }
+  if (emit_c) {
+    // Only files that can be compiled can be translated, the others need the interpreter to run
+    bool compiled = compile_program(&program);
+    if (compiled) {
+      transpile_program(&program, stdout, file_name);
+    } else {
+      fprintf(stderr, "Tarzan can't translate %s to C, it has to be interpreted\n", file_name);
+    }
+    arena_close(arena);
+    unload_file();
+    return compiled ? 0 : 1;
+  }
+
+  // Run the compiled file, or parse it and move the statements that run often to the machine
+  if (cached) {
+    vm_run(&program);
+    vm_free(&program);
+    cache_close();
+  } else if (compile && compile_program(&program)) {
+    cache_store(&program, file_name);
+    vm_run(&program);
+    vm_free(&program);
+  } else {
+    if (!interpret) {
+      tier_start();
+    }
+    while (read_position < file_size) {
+      parse_token();
+    }
+    tier_free();
+  }
+  vm_report();
+  flush_output();
+  arena_close(arena);
+  unload_file();
   i32 time_end = clock();
   printf("Tarzan done in %dms!\n", (time_end - time_start) / (CLOCKS_PER_SEC / 1000));
   return 0;
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Runs every test script with --interpret, without options, with --compile, again from the cache and translated with --emit-c,
+# and checks that each run prints the expected output in the .out file next to the script
+# usage: ./test.sh [tarzan binary], which is built from tarzan.c when it isn't given
+
+cd "$(dirname "$0")" || exit 1
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+compiler=${CC:-cc}
+tarzan=$1
+if [ -z "$tarzan" ]; then
+  tarzan=$work/tarzan
+  $compiler -std=c99 -O2 tarzan.c -o "$tarzan" || exit 1
+fi
+
+failures=0
+
+# Compares the output of a run without the timing line with the expected output
+check() {
+  script=$1
+  mode=$2
+  grep -v '^Tarzan done' "$work/output" > "$work/printed"
+  if cmp -s "$work/printed" "${script%.tzn}.out"; then
+    echo "ok   $script $mode"
+  else
+    echo "FAIL $script $mode"
+    diff "${script%.tzn}.out" "$work/printed" | head -10
+    failures=$((failures + 1))
+  fi
+}
+
+for script in test*.tzn; do
+  cache=${script%.tzn}.tzc
+  rm -f "$cache"
+  "$tarzan" --interpret "$script" > "$work/output" 2>&1
+  check "$script" --interpret
+  "$tarzan" "$script" > "$work/output" 2>&1
+  check "$script" default
+  "$tarzan" --compile "$script" > "$work/output" 2>&1
+  check "$script" --compile
+  if [ ! -f "$cache" ]; then
+    echo "FAIL $script has no cache"
+    failures=$((failures + 1))
+  fi
+  "$tarzan" "$script" > "$work/output" 2>&1
+  check "$script" cached
+  rm -f "$cache"
+  if "$tarzan" --emit-c "$script" > "$work/script.c" && $compiler -std=c99 -O2 -I . "$work/script.c" -o "$work/script"; then
+    "$work/script" > "$work/output" 2>&1
+  else
+    echo "--emit-c failed" > "$work/output"
+  fi
+  check "$script" --emit-c
+done
+
+if [ $failures -ne 0 ]; then
+  echo "$failures failed"
+  exit 1
+fi
+echo "All tests passed"
@@ -0,0 +1,142 @@
+#ifndef TARZAN_TIER
+
+/*
+
+Tiered execution, which lets a file start in the interpreter and moves the parts that run often to the register machine. It has the following functions:
+- tier_start: sets up the counters of the statements of the file
+- tier_run: runs the while or use statement at the read position as a compiled region once it's hot, returns false if the interpreter has to run it
+- tier_free: unmaps the native code of the regions
+
+Compiling the whole file before it runs takes longer than interpreting a short script that runs every statement once, while a long running script wants its loops optimized. So a file starts in the interpreter, which counts how often it reaches every while and use statement. A while is reached again for every iteration of its loop and a use every time its snippet runs, so the counts find the statements that the time goes into.
+
+A statement that is reached TIER_HOT_REGION times is compiled as a region, see compile_region, and from then on runs in the register machine whenever the interpreter gets to it. This is on-stack replacement at the header of a loop: the loop that is running in the interpreter continues in the machine from its next iteration, with the variables the interpreter has at that point. Their values are moved to the registers of the region before it runs and back to the interpreter when it halts, and the interpreter goes on after the statement. Inside the machine the loops that are hot in turn become native code, see jit.c, so a loop goes through the three tiers as it keeps running.
+
+A region is compiled for the variables the interpreter has when it gets hot, and for the division settings its divisions are computed with. When the interpreter reaches the statement with other variables, like a snippet used from two places, or after the settings changed, another region is compiled for it, and the interpreter runs the one that fits. A statement that can't be compiled stays in the interpreter, and so does one that needs more than TIER_MAX_COMPILES regions whenever none of them fits.
+
+*/
+
+// Statement compiled for the variables the interpreter had at that point
+typedef struct Region {
+  Program program;
+  i64 end; // Read position after the statement
+  i32 variable_count; // Variables of the interpreter, whose registers follow the constants
+  char **names; // Names of those variables
+  i32 precision; // Division settings the region was compiled with
+  u8 rounding;
+  struct Region *next; // Region compiled for the same statement before this one
+} Region;
+
+// Times a statement is reached before it runs in the machine
+const u32 TIER_HOT_REGION = 64;
+
+// Most times a statement is compiled
+const u32 TIER_MAX_COMPILES = 4;
+
+// Count of a statement that stays in the interpreter
+const u32 TIER_OFF = 0xFFFFFFFF;
+
+// Counters of a while or use statement
+typedef struct {
+  u32 heat; // Times the statement was reached, or TIER_OFF when no more regions are compiled for it
+  u32 compiles; // Regions compiled for the statement
+  Region *regions; // Regions compiled for the statement, the last one first
+} TierCounter;
+
+Map *tier_counters = 0; // Counters of the while and use statements that were reached, keyed by their read position, 0 when tiering is off
+Array *compiled_regions = 0; // All regions, to unmap their native code at the end
+
+// tier_start: sets up the counters of the statements of the file
+void tier_start() {
+  tier_counters = map_create(arena, sizeof(TierCounter), 0);
+  if (tier_counters == 0) {
+    printf("Memory allocation failed in tier_start\n");
+    exit(1);
+  }
+  compiled_regions = array_create(arena, sizeof(Region *));
+}
+
+// Returns true if a region was compiled for the variables and division settings the interpreter has now
+bool region_fits(Region *region) {
+  if (region->variable_count != array_length(variables) || region->precision != division_precision || region->rounding != division_rounding) {
+    return false;
+  }
+  for (i32 i = 0; i < region->variable_count; i++) {
+    char *name = ((Variable *)array_get(variables, i))->name;
+    if (name != region->names[i] && strcmp(name, region->names[i]) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Compiles the statement at the read position for the variables the interpreter has now, returns 0 if it can't be compiled
+Region *compile_hot_region(TierCounter *counter) {
+  counter->compiles += 1;
+  Region *region = (Region *)arena_fill(arena, sizeof(Region));
+  if (region == 0) {
+    printf("Memory allocation failed in compile_hot_region\n");
+    exit(1);
+  }
+  memset(region, 0, sizeof(Region));
+  if (counter->compiles > TIER_MAX_COMPILES || !compile_region(&region->program, read_position, &region->end)) {
+    counter->heat = TIER_OFF;
+    return 0;
+  }
+  region->variable_count = array_length(variables);
+  region->names = (char **)arena_fill(arena, (region->variable_count + 1) * sizeof(char *));
+  if (region->names == 0) {
+    printf("Memory allocation failed in compile_hot_region\n");
+    exit(1);
+  }
+  for (i32 i = 0; i < region->variable_count; i++) {
+    region->names[i] = ((Variable *)array_get(variables, i))->name;
+  }
+  region->precision = division_precision;
+  region->rounding = division_rounding;
+  region->next = counter->regions;
+  counter->regions = region;
+  array_push(compiled_regions, &region);
+  return region;
+}
+
+// tier_run: runs the while or use statement at the read position as a compiled region once it's hot, returns false if the interpreter has to run it
+bool tier_run() {
+  if (tier_counters == 0) return false;
+  TierCounter *counter = (TierCounter *)map_put(tier_counters, read_position);
+  if (counter == 0) {
+    printf("Memory allocation failed in tier_run\n");
+    exit(1);
+  }
+  Region *region = counter->regions;
+  while (region != 0 && !region_fits(region)) {
+    region = region->next;
+  }
+  if (region == 0) {
+    if (counter->heat == TIER_OFF) return false;
+    counter->heat += 1;
+    if (counter->heat < TIER_HOT_REGION) return false;
+    region = compile_hot_region(counter);
+    if (region == 0) return false;
+  }
+  // The variables of the interpreter follow the constants in the registers
+  Program *program = &region->program;
+  for (i32 i = 0; i < region->variable_count; i++) {
+    program->values[constant_count + i] = ((Variable *)array_get(variables, i))->value;
+  }
+  vm_run(program);
+  for (i32 i = 0; i < region->variable_count; i++) {
+    ((Variable *)array_get(variables, i))->value = program->registers[constant_count + i];
+  }
+  read_position = region->end;
+  return true;
+}
+
+// tier_free: unmaps the native code of the regions
+void tier_free() {
+  for (i32 i = 0; compiled_regions != 0 && i < array_length(compiled_regions); i++) {
+    vm_free(&(*(Region **)array_get(compiled_regions, i))->program);
+  }
+}
+
+#define TARZAN_TIER
+#endif
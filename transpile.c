@@ -0,0 +1,201 @@
+#ifndef TARZAN_TRANSPILE
+
+/*
+
+Translator from a compiled program to a C99 file that builds into a native binary of its own. It has the following functions:
+- transpile_program: writes a program for the register machine as the source of a C program
+
+The C program runs the instructions of the register machine, after all compiler passes, without the machine around them. Every register becomes a local variable of main and every instruction a statement, so the C compiler sees the whole script and can keep the registers in processor registers. Jumps become gotos to labels at their targets. Calls push the number of the instruction after them on a call stack and returns continue through a switch over those numbers, since C has no gotos to computed addresses.
+
+Numbers are the Number type of include/number.c, which the C program includes together with include/types.c, so it computes exactly what the machine computes. Integer arithmetic is done inline and wraps around like in the machine, through unsigned integers so that it's defined in C too. Printing collects lines in a buffer like the interpreter does.
+
+op_series is left out. It only computes the values a loop gives its variables without running the loop, and the C compiler is free to do the same with the loop that follows it.
+
+*/
+
+// Writes a number as a C initializer
+void transpile_number(FILE *file, Number number) {
+  if (number.value == INT64_MIN) {
+    fprintf(file, "{.value = INT64_MIN, .exponent = %d}", number.exponent);
+  } else {
+    fprintf(file, "{.value = %lldLL, .exponent = %d}", (long long)number.value, number.exponent);
+  }
+}
+
+// Writes the C condition of a conditional jump
+void transpile_condition(FILE *file, Instruction *instruction) {
+  const char *comparisons[] = {"==", "!=", "<", ">", "<=", ">="};
+  const char *comparison = comparisons[instruction->code - op_jump_if_equal];
+  fprintf(file, "compare(r%d, r%d) %s 0", instruction->b, instruction->c, comparison);
+}
+
+// transpile_program: writes a program for the register machine as the source of a C program
+void transpile_program(Program *program, FILE *file, char *file_name) {
+  Instruction *code = program->code;
+  // Instructions that are jumped to or returned to get a label, and only registers that are read get a variable
+  bool *targets = calloc(program->length + 1, sizeof(bool));
+  bool *read = calloc(program->register_count, sizeof(bool));
+  if (targets == NULL || read == NULL) {
+    printf("Memory allocation failed in transpile_program\n");
+    exit(1);
+  }
+  bool calls = false;
+  for (i32 i = 0; i < program->length; i++) {
+    u8 opcode = code[i].code;
+    if (opcode >= op_jump_if_equal && opcode <= op_call) {
+      targets[code[i].a] = true;
+    }
+    if (opcode == op_call) {
+      targets[i + 1] = true;
+      calls = true;
+    }
+    if ((opcode >= op_move && opcode <= op_jump_if_greater_equal) || opcode == op_print) {
+      read[code[i].b] = true;
+    }
+    if ((opcode >= op_add && opcode <= op_divide) || (opcode >= op_jump_if_equal && opcode <= op_jump_if_greater_equal)) {
+      read[code[i].c] = true;
+    }
+  }
+
+  fprintf(file, "// %s translated to C by tarzan --emit-c, build with: cc -std=c99 -O2 -I <tarzan directory> <this file>\n\n", file_name);
+  fprintf(file, "#include <stdio.h> // fwrite, printf\n#include <stdlib.h> // malloc, realloc, exit\n\n");
+  fprintf(file, "#include \"include/types.c\" // i32, i64, u8, u64\n#include \"include/number.c\" // Number, number_format, number_divide\n\n");
+  fprintf(file, "i32 division_precision = %d;\nu8 division_rounding = %d;\n", division_precision, division_rounding);
+  fprintf(file, "char output[%d];\ni32 output_length = 0;\n\n", OUTPUT_BUFFER_SIZE);
+  fprintf(file,
+    "void print(Number number) {\n"
+    "  if (output_length + NUMBER_TEXT_SIZE + 1 > (i32)sizeof(output)) {\n"
+    "    fwrite(output, 1, output_length, stdout);\n"
+    "    output_length = 0;\n"
+    "  }\n"
+    "  output_length += number_format(number, output + output_length);\n"
+    "  output[output_length] = '\\n';\n"
+    "  output_length += 1;\n"
+    "}\n\n");
+  // Integers wrap around through unsigned arithmetic, and everything else goes through the decimal routines
+  const char *operations[] = {"add", "+", "number_add", "subtract", "-", "number_subtract", "multiply", "*", "number_multiply"};
+  for (i32 i = 0; i < 9; i += 3) {
+    fprintf(file,
+      "static inline Number %s(Number b, Number c) {\n"
+      "  if ((b.exponent | c.exponent) == 0) return (Number){.value = (i64)((u64)b.value %s (u64)c.value), .exponent = 0};\n"
+      "  return number_compact(%s(b, c));\n"
+      "}\n\n", operations[i], operations[i + 1], operations[i + 2]);
+  }
+  fprintf(file,
+    "static inline Number increment(Number b, i64 c) {\n"
+    "  return add(b, (Number){.value = c, .exponent = 0});\n"
+    "}\n\n"
+    "static inline Number negate(Number b) {\n"
+    "  b.value = (i64)(0 - (u64)b.value);\n"
+    "  return b;\n"
+    "}\n\n"
+    "static inline i32 compare(Number b, Number c) {\n"
+    "  if ((b.exponent | c.exponent) == 0) return (b.value > c.value) - (b.value < c.value);\n"
+    "  return number_compare(b, c);\n"
+    "}\n\n");
+
+  fprintf(file, "int main() {\n");
+  for (i32 i = 0; i < program->register_count; i++) {
+    if (!read[i]) continue;
+    fprintf(file, "  Number r%d = ", i);
+    transpile_number(file, program->values[i]);
+    fprintf(file, ";\n");
+  }
+  if (calls) {
+    fprintf(file, "  i32 call_capacity = %d;\n  i32 call_depth = 0;\n  i32 *call_stack = malloc(call_capacity * sizeof(i32));\n", CALL_STACK_SIZE);
+    fprintf(file, "  if (call_stack == NULL) {\n    printf(\"Memory allocation failed\\n\");\n    exit(1);\n  }\n");
+  }
+  for (i32 i = 0; i < program->length; i++) {
+    Instruction *instruction = &code[i];
+    if (targets[i]) {
+      fprintf(file, "l%d:\n", i);
+    }
+    i32 a = instruction->a;
+    i32 b = instruction->b;
+    i32 c = instruction->c;
+    // A register that is never read doesn't need its value
+    if (instruction->code >= op_move && instruction->code <= op_negate && !read[a]) continue;
+    switch (instruction->code) {
+      case op_halt:
+        fprintf(file, "  fwrite(output, 1, output_length, stdout);\n  return 0;\n");
+        break;
+      case op_move:
+        fprintf(file, "  r%d = r%d;\n", a, b);
+        break;
+      case op_add:
+        fprintf(file, "  r%d = add(r%d, r%d);\n", a, b, c);
+        break;
+      case op_subtract:
+        fprintf(file, "  r%d = subtract(r%d, r%d);\n", a, b, c);
+        break;
+      case op_multiply:
+        fprintf(file, "  r%d = multiply(r%d, r%d);\n", a, b, c);
+        break;
+      case op_divide:
+        fprintf(file, "  r%d = number_divide(r%d, r%d, division_precision, division_rounding);\n", a, b, c);
+        break;
+      case op_increment:
+        fprintf(file, "  r%d = increment(r%d, %d);\n", a, b, c);
+        break;
+      case op_negate:
+        fprintf(file, "  r%d = negate(r%d);\n", a, b);
+        break;
+      case op_jump_if_equal:
+      case op_jump_if_not_equal:
+      case op_jump_if_less:
+      case op_jump_if_greater:
+      case op_jump_if_less_equal:
+      case op_jump_if_greater_equal:
+        fprintf(file, "  if (");
+        transpile_condition(file, instruction);
+        fprintf(file, ") goto l%d;\n", a);
+        break;
+      case op_jump:
+        fprintf(file, "  goto l%d;\n", a);
+        break;
+      case op_call:
+        fprintf(file,
+          "  if (call_depth == call_capacity) {\n"
+          "    call_capacity *= 2;\n"
+          "    call_stack = realloc(call_stack, call_capacity * sizeof(i32));\n"
+          "    if (call_stack == NULL) {\n"
+          "      printf(\"Memory allocation failed\\n\");\n"
+          "      exit(1);\n"
+          "    }\n"
+          "  }\n"
+          "  call_stack[call_depth] = %d;\n"
+          "  call_depth += 1;\n"
+          "  goto l%d;\n", i + 1, a);
+        break;
+      case op_return:
+        fprintf(file, "  goto return_to_caller;\n");
+        break;
+      case op_print:
+        fprintf(file, "  print(r%d);\n", b);
+        break;
+      case op_precision:
+        fprintf(file, "  division_precision = %d;\n", b);
+        break;
+      case op_rounding:
+        fprintf(file, "  division_rounding = %d;\n", b);
+        break;
+      case op_series:
+        break;
+    }
+  }
+  if (calls) {
+    fprintf(file, "return_to_caller:\n  call_depth -= 1;\n  switch (call_stack[call_depth]) {\n");
+    for (i32 i = 0; i < program->length; i++) {
+      if (code[i].code == op_call) {
+        fprintf(file, "    case %d: goto l%d;\n", i + 1, i + 1);
+      }
+    }
+    fprintf(file, "  }\n  return 1;\n");
+  }
+  fprintf(file, "}\n");
+  free(targets);
+  free(read);
+}
+
+#define TARZAN_TRANSPILE
+#endif
@@ -0,0 +1,461 @@
+#ifndef TARZAN_VM
+
+/*
+
+Register based virtual machine for compiled Tarzan programs that has the following functions:
+- vm_run: runs a program from its first instruction until it halts
+- vm_free: unmaps the native code of a program
+- vm_report: prints the number of instructions all programs ran, when built with -DTARZAN_BENCH
+
+Every instruction reads and writes numbered registers. The registers start with the constant pool, so constant number n is register n, followed by the variable registers, the registers the optimizer added and the temporary registers. This means that a statement like `sum = sum + (i * j) - (i + j)` runs as four arithmetic instructions that read the variables and write sum directly, without moving values around.
+
+Common statement shapes get one instruction each: `i = i + 1` is a single op_increment with the 1 inside the instruction, and a comparison and the jump that depends on it are a single op_jump_if. Loops test their condition at the bottom, so a loop runs one jump per iteration on top of its body.
+
+Arithmetic on two integers (exponent 0) is done inline and all other numbers go through the decimal routines in include/number.c.
+
+A counted loop that only adds up induction variables is computed by op_series instead of run: from the number of iterations it gives every variable of the loop the value it has after the last one, using n * start + n * (n - 1) / 2 * step for a sum of an induction variable. The values are computed as integers at the lowest exponent involved, so they are exact. When any value the loop would go through doesn't fit in 64 bits, or when the loop never ends, op_series changes nothing and the loop runs as usual, so the results are the same either way.
+
+With GCC and Clang the instructions are direct threaded: before the program runs every instruction gets the address of the code that runs it, and each instruction ends by jumping straight to the code of the next one. Every instruction then has its own indirect jump that the branch predictor can learn, instead of all of them sharing the one jump of a switch. Building with -DTARZAN_SWITCH_DISPATCH uses a portable switch instead, and -DTARZAN_BENCH prints how many instructions ran and the average time each took.
+
+A program can run more than once, like a loop that the interpreter hands to the machine every time it reaches it. Its registers and the native code of its loops are kept between runs, and every run starts with the registers set to the values of the program.
+
+On x86-64 Linux, loops that only do integer arithmetic run as native code once they are hot, see jit.c. Building with -DTARZAN_NO_JIT keeps them in the machine, and the instructions of native code aren't counted by -DTARZAN_BENCH.
+
+*/
+
+typedef enum {
+  op_halt, // stop the program
+  op_move, // a = b
+  op_add, // a = b + c
+  op_subtract, // a = b - c
+  op_multiply, // a = b * c
+  op_divide, // a = b / c
+  op_increment, // a = b + c, where c is an integer and not a register
+  op_negate, // a = -b
+  op_jump_if_equal, // continue at instruction a if b == c
+  op_jump_if_not_equal, // continue at instruction a if b != c
+  op_jump_if_less, // continue at instruction a if b < c
+  op_jump_if_greater, // continue at instruction a if b > c
+  op_jump_if_less_equal, // continue at instruction a if b <= c
+  op_jump_if_greater_equal, // continue at instruction a if b >= c
+  op_jump, // continue at instruction a
+  op_call, // push the next instruction on the call stack and continue at instruction a
+  op_return, // continue at the instruction on top of the call stack
+  op_print, // print b
+  op_precision, // divisions keep b decimals
+  op_rounding, // divisions use rounding mode b
+  op_series // set the registers of the loop that series a computes to their values after the loop, or leave them if it can't be computed exactly
+} Opcode;
+
+typedef struct {
+  u8 code;
+  const void *handler; // address of the code that runs the instruction when it is direct threaded
+  i32 a;
+  i32 b;
+  i32 c;
+} Instruction;
+
+// Value a series adds to a register over the iterations of its loop
+typedef struct {
+  i32 target; // Register of an induction variable or a sum, which holds its value before the loop
+  i32 source; // Register of the value that is added in every iteration
+  bool triangular; // Set when the source is added 0 times in the first iteration, once in the second one and so on, which is how the step of an induction variable adds up in a sum of it
+  bool negative; // Set when the source is subtracted
+} SeriesTerm;
+
+// Counted loop that only changes induction variables and sums of them
+typedef struct {
+  i32 counter; // Register of the induction variable the condition compares
+  i32 step; // Register of the step of the counter
+  bool decreasing; // Set when the step is subtracted
+  i32 bound; // Register of the value the counter is compared to
+  u8 comparator; // The loop goes on while `counter comparator bound` holds
+  i32 first_term; // Index of the first term in the terms of the program, with the terms of the sums before those of the induction variables
+  i32 term_count;
+} Series;
+
+typedef struct {
+  Instruction *code;
+  i32 length;
+  i32 register_count;
+  Number *values; // Values of the registers when the program starts
+  Series *series;
+  i32 series_count;
+  SeriesTerm *series_terms;
+  i32 series_term_count;
+  Number *registers; // Registers of the last run, 0 until the program runs
+  struct Jit *jit; // Native code of the loops of the program, 0 until the program runs
+} Program;
+
+// Number of calls the call stack has room for before it grows
+const i32 CALL_STACK_SIZE = 256;
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(TARZAN_SWITCH_DISPATCH)
+#define VM_THREADED
+#endif
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(TARZAN_NO_JIT)
+#define VM_JIT
+#endif
+
+#ifdef TARZAN_BENCH
+#define VM_COUNT() executed += 1
+u64 bench_executed = 0; // Instructions run by all programs
+f64 bench_time = 0; // Seconds spent running them
+#else
+#define VM_COUNT()
+#endif
+
+// Every instruction ends with VM_NEXT or VM_JUMP, which go on to the next instruction either through its handler address or back to the switch
+#ifdef VM_THREADED
+#define VM_CASE(code) label_##code:
+#define VM_DISPATCH() VM_COUNT(); goto *instruction->handler
+#define VM_NEXT() instruction += 1; VM_DISPATCH()
+#define VM_JUMP(target) instruction = code + (target); VM_DISPATCH()
+#else
+#define VM_CASE(code) case code:
+#define VM_NEXT() instruction += 1; VM_COUNT(); continue
+#define VM_JUMP(target) instruction = code + (target); VM_COUNT(); continue
+#endif
+
+// Arithmetic on two registers, with an inline path for integers that wraps around through unsigned arithmetic, which is defined in C
+#define VM_ARITHMETIC(operator, function) { \
+    Number b = registers[instruction->b]; \
+    Number c = registers[instruction->c]; \
+    Number *a = &registers[instruction->a]; \
+    if ((b.exponent | c.exponent) == 0) { \
+      a->value = (i64)((u64)b.value operator (u64)c.value); \
+      a->exponent = 0; \
+    } else { \
+      *a = number_compact(function(b, c)); \
+    } \
+  }
+
+// a = b + c where c is in the instruction, with an inline path for integers
+#define VM_INCREMENT() { \
+    Number b = registers[instruction->b]; \
+    Number *a = &registers[instruction->a]; \
+    if (b.exponent == 0) { \
+      a->value = (i64)((u64)b.value + (u64)(i64)instruction->c); \
+      a->exponent = 0; \
+    } else { \
+      *a = number_compact(number_add(b, (Number){.value = instruction->c, .exponent = 0})); \
+    } \
+  }
+
+#define VM_NEGATE() { \
+    registers[instruction->a] = registers[instruction->b]; \
+    registers[instruction->a].value = (i64)(0 - (u64)registers[instruction->a].value); \
+  }
+
+// Comparison of two registers, with an inline path for integers
+#define VM_COMPARE(operator) \
+  ((registers[instruction->b].exponent | registers[instruction->c].exponent) == 0 ? \
+    registers[instruction->b].value operator registers[instruction->c].value : \
+    number_compare(registers[instruction->b], registers[instruction->c]) operator 0)
+
+// Pushes a return address on the call stack, which grows when it's full
+#define VM_PUSH_CALL(address) { \
+    if (call_depth == call_capacity) { \
+      call_capacity *= 2; \
+      call_stack = realloc(call_stack, call_capacity * sizeof(i32)); \
+      if (call_stack == NULL) { \
+        flush_output(); \
+        printf("Memory allocation failed in vm_run\n"); \
+        exit(1); \
+      } \
+    } \
+    call_stack[call_depth] = (address); \
+    call_depth += 1; \
+  }
+
+// A jump back to an earlier instruction ends an iteration of a loop, which runs as native code once it's hot
+#ifdef VM_JIT
+#define VM_LOOP() \
+  if (instruction->a <= instruction - code && jit->heat[instruction - code] != JIT_OFF) { \
+    i32 resume = jit_run_loop(jit, registers, (i32)(instruction - code)); \
+    if (resume >= 0) { \
+      for (i32 frame = 0; frame < jit->frame_count; frame++) { \
+        VM_PUSH_CALL(jit->frames[frame]); \
+      } \
+      VM_JUMP(resume); \
+    } \
+  }
+#else
+#define VM_LOOP()
+#endif
+
+// Jump when the comparison of two registers holds
+#define VM_BRANCH(operator) { \
+    if (VM_COMPARE(operator)) { \
+      VM_LOOP(); \
+      VM_JUMP(instruction->a); \
+    } \
+  }
+
+// Writes a number as a value with a lower exponent, returns false if it doesn't fit
+bool scale_number(Number number, i16 exponent, i64 *value) {
+  *value = number.value;
+  if (*value == INT64_MIN) return false;
+  for (i32 i = exponent; i < number.exponent; i++) {
+    if (*value > INT64_MAX / 10 || *value < -(INT64_MAX / 10)) return false;
+    *value *= 10;
+  }
+  return true;
+}
+
+bool add_fits(i64 a, i64 b, i64 *result) {
+  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < -INT64_MAX - b)) return false;
+  *result = a + b;
+  return true;
+}
+
+bool multiply_fits(i64 a, i64 b, i64 *result) {
+  if (a != 0 && (b > INT64_MAX / (a < 0 ? -a : a) || b < -(INT64_MAX / (a < 0 ? -a : a)))) return false;
+  *result = a * b;
+  return true;
+}
+
+// Computes the values the registers of a series have after its loop, and writes them if write is true. Returns false if the loop doesn't end or if a value it computes along the way doesn't fit in 64 bits, so the loop has to run to get the same results.
+bool run_series(Series *series, SeriesTerm *terms, Number *registers, bool write) {
+  // Everything is computed as integers at the lowest exponent of the values involved, which is exact
+  i16 exponent = registers[series->counter].exponent;
+  if (registers[series->step].exponent < exponent) exponent = registers[series->step].exponent;
+  if (registers[series->bound].exponent < exponent) exponent = registers[series->bound].exponent;
+  for (i32 i = 0; i < series->term_count; i++) {
+    SeriesTerm *term = &terms[series->first_term + i];
+    if (registers[term->target].exponent < exponent) exponent = registers[term->target].exponent;
+    if (registers[term->source].exponent < exponent) exponent = registers[term->source].exponent;
+  }
+  i64 counter, step, bound;
+  if (!scale_number(registers[series->counter], exponent, &counter) || !scale_number(registers[series->step], exponent, &step) || !scale_number(registers[series->bound], exponent, &bound)) {
+    return false;
+  }
+  if (series->decreasing) {
+    step = -step;
+  }
+
+  u8 comparator = series->comparator;
+  bool runs = counter == bound;
+  if (comparator == comparators.less_than) {
+    runs = counter < bound;
+  } else if (comparator == comparators.greater_than) {
+    runs = counter > bound;
+  } else if (comparator == comparators.less_than_or_equal_to) {
+    runs = counter <= bound;
+  } else if (comparator == comparators.greater_than_or_equal_to) {
+    runs = counter >= bound;
+  }
+  i64 iterations = 0;
+  if (runs && comparator == comparators.equal_to) {
+    if (step == 0) return false;
+    iterations = 1;
+  } else if (runs) {
+    // The counter has to move towards the bound, or the loop never ends
+    bool rising = comparator == comparators.less_than || comparator == comparators.less_than_or_equal_to;
+    i64 distance;
+    if ((rising && step <= 0) || (!rising && step >= 0) || !add_fits(rising ? bound : counter, rising ? -counter : -bound, &distance)) {
+      return false;
+    }
+    i64 stride = rising ? step : -step;
+    bool inclusive = comparator == comparators.less_than_or_equal_to || comparator == comparators.greater_than_or_equal_to;
+    if (!add_fits(distance / stride, inclusive || distance % stride != 0, &iterations)) return false;
+  }
+  // 0 + 1 + ... + (iterations - 1), halving the even factor first
+  i64 triangle;
+  if (!multiply_fits(iterations % 2 == 0 ? iterations / 2 : iterations, iterations % 2 == 0 ? iterations - 1 : (iterations - 1) / 2, &triangle)) {
+    return false;
+  }
+
+  i32 i = 0;
+  while (i < series->term_count) {
+    i32 target = terms[series->first_term + i].target;
+    i64 total, magnitude;
+    if (!scale_number(registers[target], exponent, &total)) return false;
+    // Every value the register has during the loop is at most the sum of the magnitudes of its start and its terms
+    magnitude = total < 0 ? -total : total;
+    for (; i < series->term_count && terms[series->first_term + i].target == target; i++) {
+      SeriesTerm *term = &terms[series->first_term + i];
+      i64 source, added;
+      if (!scale_number(registers[term->source], exponent, &source) || !multiply_fits(term->triangular ? triangle : iterations, source, &added)) {
+        return false;
+      }
+      if (!add_fits(magnitude, added < 0 ? -added : added, &magnitude)) return false;
+      total += term->negative ? -added : added;
+    }
+    if (write) {
+      registers[target] = number_compact((Number){.value = total, .exponent = exponent});
+    }
+  }
+  return true;
+}
+
+#include "jit.c" // Jit, jit_create, jit_run_loop, jit_free
+
+// vm_run: runs a program from its first instruction until it halts
+void vm_run(Program *program) {
+  if (program->registers == 0) {
+    program->registers = (Number *)arena_fill(arena, program->register_count * sizeof(Number));
+  }
+  Number *registers = program->registers;
+  memcpy(registers, program->values, program->register_count * sizeof(Number));
+  i32 call_capacity = CALL_STACK_SIZE;
+  i32 call_depth = 0;
+  i32 *call_stack = malloc(call_capacity * sizeof(i32));
+  if (call_stack == NULL) {
+    printf("Memory allocation failed in vm_run\n");
+    exit(1);
+  }
+
+  Instruction *code = program->code;
+  Instruction *instruction = code;
+#ifdef VM_JIT
+  if (program->jit == 0) {
+    program->jit = (Jit *)arena_fill(arena, sizeof(Jit));
+    *program->jit = jit_create(program);
+  }
+  Jit *jit = program->jit;
+#endif
+#ifdef TARZAN_BENCH
+  u64 executed = 1;
+  clock_t bench_start = clock();
+#endif
+
+#ifdef VM_THREADED
+  // Handler addresses in the same order as Opcode
+  static const void *handlers[] = {
+    &&label_op_halt, &&label_op_move, &&label_op_add, &&label_op_subtract, &&label_op_multiply, &&label_op_divide,
+    &&label_op_increment, &&label_op_negate, &&label_op_jump_if_equal, &&label_op_jump_if_not_equal, &&label_op_jump_if_less,
+    &&label_op_jump_if_greater, &&label_op_jump_if_less_equal, &&label_op_jump_if_greater_equal,
+    &&label_op_jump, &&label_op_call, &&label_op_return, &&label_op_print,
+    &&label_op_precision, &&label_op_rounding, &&label_op_series
+  };
+  for (i32 i = 0; i < program->length; i++) {
+    code[i].handler = handlers[code[i].code];
+  }
+  goto *instruction->handler;
+#else
+  while (true) {
+    switch (instruction->code) {
+#endif
+      VM_CASE(op_halt) {
+        free(call_stack);
+#ifdef TARZAN_BENCH
+        bench_executed += executed;
+        bench_time += (f64)(clock() - bench_start) / CLOCKS_PER_SEC;
+#endif
+        return;
+      }
+      VM_CASE(op_move) {
+        registers[instruction->a] = registers[instruction->b];
+        VM_NEXT();
+      }
+      VM_CASE(op_add) {
+        VM_ARITHMETIC(+, number_add);
+        VM_NEXT();
+      }
+      VM_CASE(op_subtract) {
+        VM_ARITHMETIC(-, number_subtract);
+        VM_NEXT();
+      }
+      VM_CASE(op_multiply) {
+        VM_ARITHMETIC(*, number_multiply);
+        VM_NEXT();
+      }
+      VM_CASE(op_divide) {
+        registers[instruction->a] = number_divide(registers[instruction->b], registers[instruction->c], division_precision, division_rounding);
+        VM_NEXT();
+      }
+      VM_CASE(op_increment) {
+        VM_INCREMENT();
+        VM_NEXT();
+      }
+      VM_CASE(op_negate) {
+        VM_NEGATE();
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_equal) {
+        VM_BRANCH(==);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_not_equal) {
+        VM_BRANCH(!=);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_less) {
+        VM_BRANCH(<);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_greater) {
+        VM_BRANCH(>);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_less_equal) {
+        VM_BRANCH(<=);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump_if_greater_equal) {
+        VM_BRANCH(>=);
+        VM_NEXT();
+      }
+      VM_CASE(op_jump) {
+        VM_LOOP();
+        VM_JUMP(instruction->a);
+      }
+      VM_CASE(op_call) {
+        VM_PUSH_CALL((i32)(instruction - code) + 1);
+        VM_JUMP(instruction->a);
+      }
+      VM_CASE(op_return) {
+        call_depth -= 1;
+        VM_JUMP(call_stack[call_depth]);
+      }
+      VM_CASE(op_print) {
+        print_number(registers[instruction->b]);
+        VM_NEXT();
+      }
+      VM_CASE(op_precision) {
+        division_precision = instruction->b;
+        VM_NEXT();
+      }
+      VM_CASE(op_rounding) {
+        division_rounding = (u8)instruction->b;
+        VM_NEXT();
+      }
+      VM_CASE(op_series) {
+        // The values are only written once all of them are known to fit, so the loop can still run if one doesn't
+        Series *series = &program->series[instruction->a];
+        if (run_series(series, program->series_terms, registers, false)) {
+          run_series(series, program->series_terms, registers, true);
+        }
+        VM_NEXT();
+      }
+#ifndef VM_THREADED
+    }
+  }
+#endif
+}
+
+// vm_free: unmaps the native code of a program
+void vm_free(Program *program) {
+#ifdef VM_JIT
+  if (program->jit != 0) {
+    jit_free(program->jit);
+    program->jit = 0;
+  }
+#else
+  (void)program;
+#endif
+}
+
+// vm_report: prints the number of instructions all programs ran, when built with -DTARZAN_BENCH
+void vm_report() {
+#ifdef TARZAN_BENCH
+  if (bench_executed == 0) return;
+  flush_output();
+  printf("Tarzan ran %llu instructions in %.0fms, %.2fns per instruction\n", (unsigned long long)bench_executed, bench_time * 1000, bench_time * 1e9 / (f64)bench_executed);
+#endif
+}
+
+#define TARZAN_VM
+#endif
\ No newline at end of file